@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "philox.h"
 
 #define N1 320
 #define N1d2 (N1/2)
@@ -13,15 +16,83 @@
 #define VOLUME N1*N2
 #define VOLUMEd2 N1d2*N2
 
-/* 2d Ising model using Metropolis update algorithm */
+/* The seed of the random numbers */
+#define SEED 1225
+
+/* 2d Ising model using Metropolis update algorithm
+
+   Compile with
+     gcc -O3 -o ising2d4 ising2d4.c philox.c -lm
+   The random number of a site is keyed by the sweep and the index
+   of the site, as in ising2d4_mpi.c, so both give the same results. */
+
+/* The acceptance probability exp(-beta*deltae) of a flip, for the
+   five changes of the energy a flip can make, deltae = -8,-4,0,4,8.
+   The table is rebuilt whenever beta changes. A flip that does not
+   raise the energy is always accepted. */
+static float table_beta;
+static int table_set = 0;
+static float boltzmann[5];
+
+static void set_boltzmann(float beta) {
+  if(table_set && beta == table_beta) return;
+  for(int k = 0;k < 5;k++) boltzmann[k] = exp(-beta*(4*k-8));
+  table_beta = beta;
+  table_set = 1;
+}
+
+/* Branch free, so that a row is updated with vector instructions */
+#define ACCEPT(deltae, r) (((deltae) <= 0) | (boltzmann[((deltae)+8)/4] > (r)))
+
+/* The spins are stored as bytes in two arrays, one for each colour.
+   A row of a colour holds its N1d2 sites between two padding sites,
+   copies of the last and the first site of the row, and the rows
+   -1 and N2 copy the last and the first row. The neighbours of a
+   site are then at fixed offsets in the other colour: i2 in the rows
+   above and below, and i2 and i2+shift in the same row, where shift
+   is -1 on rows that start with this colour and +1 otherwise. */
+#define ROW (N1d2+2)
+#define SPIN(c, j, i2) ((c)[((j)+1)*ROW + (i2)+1])
+
+static int row_shift(int parity, int j) {
+  return (parity+j)%2 ? 1 : -1;
+}
+
+/* Copy the first and last sites and rows of a colour to the padding */
+static void pad(signed char *c) {
+  for(int j = 0;j < N2;j++) {
+    SPIN(c,j,-1) = SPIN(c,j,N1d2-1);
+    SPIN(c,j,N1d2) = SPIN(c,j,0);
+  }
+  memcpy(&SPIN(c,-1,-1), &SPIN(c,N2-1,-1), ROW);
+  memcpy(&SPIN(c,N2,-1), &SPIN(c,0,-1), ROW);
+}
+
+/* Try to flip each site of one colour in a row, given the rows of
+   the other colour above, beside and below it. Adds the energy and
+   the magnetisation after the update to the sums. */
+static void update_row(signed char *restrict row, const signed char *restrict up,
+                       const signed char *restrict same, const signed char *restrict down,
+                       int shift, const double *restrict r, int *esum, int *mag) {
+  int e = 0, m = 0;
+  for(int i = 0;i < N1d2;i++) {
+    int neighbours = up[i] + down[i] + same[i] + same[i+shift];
+    int energy_now = -row[i]*neighbours;
+    int flip = ACCEPT(-2*energy_now, r[i]);
+    row[i] = flip ? -row[i] : row[i];
+    e += flip ? -energy_now : energy_now;
+    m += row[i];
+  }
+  *esum += e;
+  *mag += m;
+}
 
 int main(int argc, char** argv) {
 
-  short int seed[3];
   int n,i,j,iter;
-  int xup[VOLUME], yup[VOLUME], xdn[VOLUME], ydn[VOLUME];
   float beta,esum,mag;
-  float s[VOLUME];
+  static signed char s[2][(N2+2)*ROW];
+  static double rnd[VOLUMEd2];
   FILE *fp;
 
   double esumt, magt;
@@ -32,38 +103,19 @@ int main(int argc, char** argv) {
   fscanf(fp,"iter %d\n",&iter);
   fclose(fp);
 
-  /* Set random seed for erand */
-  seed[0]=13; seed[1]=35; seed[2]=17;
-
-  /* Initialize each point randomly */
+  /* Initialize each point randomly. The sites are numbered colour by
+     colour, even sites first, row after row. */
   for(i = 0;i < VOLUME;i++) {
-    if(erand48(seed) < 0.5){
-      s[i] = 1.0;
-    }
-    else {
-      s[i] = -1.0;
-    }
-  }
-
-  /* Create and index of neighbours
-     The sites are partitioned to even an odd,
-     with even sites first in the array */
-  for( j=0; j<N2; j++) for( i=0; i<N1; i++) {
-    int i2 = i/2;
-    int is = i2 + j*N1d2;
-    if( (i+j)%2 == 0 ) {
-	    xup[is] = ((i+1)/2)%N1d2 + j*N1d2 + VOLUMEd2;
-	    yup[is] = i2 + ((j+1)%N2)*N1d2 + VOLUMEd2;
-	    xdn[is] = ((i-1+N1)/2)%N1d2 + j*N1d2 + VOLUMEd2;
-	    ydn[is] = i2 + ((j-1+N2)%N2)*N1d2 + VOLUMEd2;
+    int parity = i/(VOLUMEd2), k = i%(VOLUMEd2);
+    if(philox_uniform(SEED, 0, i) < 0.5){
+      SPIN(s[parity], k/N1d2, k%N1d2) = 1;
     }
     else {
-	    xup[is+VOLUMEd2] = ((i+1)/2)%N1d2 + j*N1d2;
-	    yup[is+VOLUMEd2] = i2 + ((j+1)%N2)*N1d2;
-	    xdn[is+VOLUMEd2] = ((i-1+N1)/2)%N1d2 + j*N1d2;
-	    ydn[is+VOLUMEd2] = i2 + ((j-1+N2)%N2)*N1d2;
+      SPIN(s[parity], k/N1d2, k%N1d2) = -1;
     }
   }
+  pad(s[0]);
+  pad(s[1]);
 
   /* Initialize the measurements */
   esumt = 0.0;
@@ -71,33 +123,28 @@ int main(int argc, char** argv) {
 
   /* Run a number of iterations */
   for(n = 0;n < iter;n++) {
-    esum = 0.0;
-    mag = 0.0;
-
-    /* Loop over the lattice and try to flip each atom */
-    for(i = 0;i < VOLUME;i++) {
-      float new_energy, energy_now, deltae;
-      float stmp;
-      float neighbours = s[xup[i]] + s[yup[i]] + s[xdn[i]] + s[ydn[i]];
-      stmp = -s[i];
-
-      /* Find the energy before and after the flip */
-      energy_now = -s[i]*neighbours;
-      new_energy = -stmp*neighbours;
-      deltae = new_energy-energy_now;
-      
-      /* Accept or reject the change */
-      if( exp(-beta*deltae) > erand48(seed) ){
-	      s[i] = stmp;
-	      energy_now = new_energy;
+    int esum_sites = 0, mag_sites = 0;
+    set_boltzmann(beta);
+
+    /* Loop over the lattice and try to flip each atom, first the even
+       sites and then the odd ones */
+    for(int parity = 0;parity < 2;parity++) {
+      signed char *c = s[parity], *other = s[1-parity];
+
+      /* The random numbers of the colour, one for each site. The
+         flips that lower the energy do not use theirs, but drawing
+         them all at once is faster than drawing one where needed. */
+      philox_uniforms(SEED, 2*n + parity + 1, 0, VOLUMEd2, rnd);
+      for(j = 0;j < N2;j++) {
+        update_row(&SPIN(c,j,0), &SPIN(other,j+1,0), &SPIN(other,j,0), &SPIN(other,j-1,0),
+                   row_shift(parity,j), rnd + j*N1d2, &esum_sites, &mag_sites);
       }
-
-      /* Measure magnetisation and energy */
-      mag = mag + s[i];
-      esum = esum + energy_now;
+      pad(c);
     }
 
     /* Calculate measurements and add to run averages  */
+    esum = esum_sites;
+    mag = mag_sites;
     esum = esum/(VOLUME);
     mag = mag/(VOLUME);
     esumt = esumt + esum;
@@ -16,22 +16,23 @@ c     2d Ising model using Metropolis update algorithm
 
       double precision esumt,magt
 
-      integer*2 seed(3)
-      common/seeds/seed
+c     the random number of a site is keyed by the seed, the sweep and
+c     the index of the site, as in the C codes (see philox.c)
+      double precision philox_uniform
+      external philox_uniform
+      integer*8 iseed,isweep,isite
 
-      seed(1) = 1225
-      seed(2) = 4739
-      seed(3) = 9753
+      iseed = 1225
 
       write(6,*) 'beta = '
       read(5,*) beta
       write(6,*) 'iteration = '
       read(5,*) iter
 
-      call ranset(seed)
-
+      isweep = 0
       do i = 1, ip2
-         if(ranf() .lt. 0.5) then
+         isite = i-1
+         if(philox_uniform(iseed,isweep,isite) .lt. 0.5) then
             s(i) = 1.0
          else
             s(i) = -1.0
@@ -78,12 +79,14 @@ c      enddo
          esum = 0.0
          mag = 0.0
          do i = 1, ip2
+            isweep = 2*(n-1) + (i-1)/ip2d2 + 1
+            isite = mod(i-1,ip2d2)
             env = s(iup(i,1))+s(iup(i,2))+s(idn(i,1))+s(idn(i,2))
             energy0 = -beta*s(i)*env
             stmp = -s(i)
             energy = -beta*stmp*env
             deltae = energy0-energy
-            if(exp(deltae) .gt. ranf()) then
+            if(exp(deltae) .gt. philox_uniform(iseed,isweep,isite)) then
                s(i) = stmp
                energy0 = energy
             endif
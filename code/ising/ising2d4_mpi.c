@@ -5,45 +5,194 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <mpi.h>
 
+#include "philox.h"
+
 #define N1 320
 #define N1d2 (N1/2)
 #define N2 320
 
 #define VOLUME N1*N2
-#define VOLUMEd2 N1*N2
+#define VOLUMEd2 N1d2*N2
+
+/* The seed of the random numbers */
+#define SEED 1225
 
 /*  2d Ising model using Metropolis update algorithm
     periodic boundary condition for x- and y-direction
     version 3 : checker board partitioned
     MPI version
-    assumes that 1-D ring topology in the y direction and no of ranks is
-    a divisor of N2 and N2/n_ranks is an even integer for convenience */
+    assumes a 1-D ring topology in the y direction. The rows are
+    split as evenly as possible, the first N2%n_ranks ranks get one
+    extra row. Each rank needs at least two rows.
+    Compile with
+      mpicc -O3 -o ising2d4_mpi ising2d4_mpi.c philox.c -lm
+    The boundary rows of the neighbours are received into ghost rows
+    while the bulk of the rows of the rank is updated.
+    When compiled with -fopenmp, the update is shared between
+    OMP_NUM_THREADS threads per rank.
+    The random numbers come from a counter based generator keyed by
+    the sweep and the global index of the site, so a run gives the
+    same results on any number of ranks and threads, and the same as
+    ising2d4.c.
+    With a line "checkpoint k" in the parameter file the state is
+    saved every k iterations, and with a further line "restart 1"
+    the run continues from the last checkpoint, on any number of
+    ranks */
+
+/* The acceptance probability exp(-beta*deltae) of a flip, for the
+   five changes of the energy a flip can make, deltae = -8,-4,0,4,8.
+   The table is rebuilt whenever beta changes. A flip that does not
+   raise the energy is always accepted. */
+static float table_beta;
+static int table_set = 0;
+static float boltzmann[5];
+
+static void set_boltzmann(float beta) {
+  if(table_set && beta == table_beta) return;
+  for(int k = 0;k < 5;k++) boltzmann[k] = exp(-beta*(4*k-8));
+  table_beta = beta;
+  table_set = 1;
+}
+
+/* Branch free, so that a row is updated with vector instructions */
+#define ACCEPT(deltae, r) (((deltae) <= 0) | (boltzmann[((deltae)+8)/4] > (r)))
+
+/* The random numbers of a row of one colour in a sweep. Each site of
+   a colour has its own number, the sweep counts the half sweeps.
+   The whole row is drawn, also the numbers of the flips that lower
+   the energy and need none. Drawing them one by one, only where
+   needed, is several times slower than a vectorised row. */
+static void row_uniforms(double *r, int n, int parity, int j_global) {
+  philox_uniforms(SEED, 2*(uint64_t)n + parity + 1, (uint64_t)j_global*N1d2, N1d2, r);
+}
+
+/* The spins are stored as bytes in two arrays, one for each colour,
+   with the rows of this rank one after the other between two ghost
+   rows, -1 and subN2, copies of the rows of the neighbours below and
+   above. A row of a colour
+   holds its N1d2 sites between two padding sites, copies of the last
+   and the first site of the row. The neighbours of a site are then at
+   fixed offsets in the other colour: i2 in the rows above and below,
+   and i2 and i2+shift in the same row, where shift is -1 on rows that
+   start with this colour and +1 otherwise. The parity of a row is
+   that of the global row. */
+#define ROW (N1d2+2)
+#define SPIN(c, j, i2) ((c)[((j)+1)*ROW + (i2)+1])
+
+static int row_shift(int parity, int j_global) {
+  return (parity+j_global)%2 ? 1 : -1;
+}
+
+/* Copy the first and last site of each row to the padding */
+static void pad_rows(signed char *c, int rows) {
+  for(int j = 0;j < rows;j++) {
+    SPIN(c,j,-1) = SPIN(c,j,N1d2-1);
+    SPIN(c,j,N1d2) = SPIN(c,j,0);
+  }
+}
+
+/* Try to flip each site of one colour in a row, given the rows of
+   the other colour above, beside and below it. Adds the energy and
+   the magnetisation after the update to the sums. */
+static void update_row(signed char *restrict row, const signed char *restrict up,
+                       const signed char *restrict same, const signed char *restrict down,
+                       int shift, const double *restrict r, int *esum, int *mag) {
+  int e = 0, m = 0;
+  for(int i = 0;i < N1d2;i++) {
+    int neighbours = up[i] + down[i] + same[i] + same[i+shift];
+    int energy_now = -row[i]*neighbours;
+    int flip = ACCEPT(-2*energy_now, r[i]);
+    row[i] = flip ? -row[i] : row[i];
+    e += flip ? -energy_now : energy_now;
+    m += row[i];
+  }
+  *esum += e;
+  *mag += m;
+}
+
+/* Update one colour in the rows first to last-1. The sites of one
+   colour only depend on the other colour, so the rows can be shared
+   between threads. */
+static void update_rows(signed char *c, const signed char *other, int parity, int n,
+                        int j_offset, int first, int last, int *esum, int *mag) {
+  int e = 0, m = 0;
+#pragma omp parallel for reduction(+:e,m)
+  for(int j = first;j < last;j++) {
+    double r[N1d2];
+    row_uniforms(r,n,parity,j+j_offset);
+    update_row(&SPIN(c,j,0),&SPIN(other,j+1,0),&SPIN(other,j,0),&SPIN(other,j-1,0),
+               row_shift(parity,j+j_offset),r,&e,&m);
+  }
+  *esum += e;
+  *mag += m;
+}
+
+#define CHECKPOINT_FILE "ising_checkpoint.bin"
+
+/* A checkpoint file starts with this header. The spins of the
+   whole lattice follow in their natural order, row after row. The
+   layout does not depend on the number of ranks, and the random
+   numbers only on the seed and the iteration, so a run continues
+   exactly on any number of ranks. */
+typedef struct {
+  char magic[8];
+  int n1, n2;
+  int iterations;          /* the iterations done */
+  int seed;
+  float beta;
+  double esumt, magt;      /* sums of the measurements so far */
+} checkpoint_header;
+
+/* Copy between the colours of the rows of this rank and the natural
+   ordering of the file */
+static void to_natural(float *lattice, signed char *s[2], int subN2, int j_offset) {
+  for(int j = 0;j < subN2;j++) for(int i = 0;i < N1;i++)
+    lattice[i + j*N1] = SPIN(s[(i+j+j_offset)%2],j,i/2);
+}
+
+static void from_natural(signed char *s[2], const float *lattice, int subN2, int j_offset) {
+  for(int j = 0;j < subN2;j++) for(int i = 0;i < N1;i++)
+    SPIN(s[(i+j+j_offset)%2],j,i/2) = lattice[i + j*N1];
+  pad_rows(s[0],subN2);
+  pad_rows(s[1],subN2);
+}
 
 int main(int argc, char** argv) {
 
-  short int seed[3];
-  int n,i,j,is,ii,itag,iter;
-  int xup[VOLUME], yup[VOLUME], xdn[VOLUME], ydn[VOLUME];
-  int rank, n_ranks, nextup, nextdn, iroot, subN2, subVOLUME, subVOLUMEd2;
-  float s[VOLUME], stmp, sendbuf[N1d2], recvbuf[N1d2];
-  float beta, new_energy, energy_now, deltae;
+  int n,i,j,iter;
+  int rank, n_ranks, nextup, nextdn, iroot, subN2, subVOLUME;
+  int j_offset, thread_support;
+  int n_start, checkpoint_every, restart, pending;
+  float *lattice;
+  checkpoint_header header;
+  MPI_File file;
+  MPI_Request file_request;
+  signed char *s[2];
+  MPI_Request ghost[2][4];
+  float beta;
 
   double esumt,magt,esum,mag,esumsub,magsub;
 
-  MPI_Status status;
-  MPI_Request request;
-
   /* Initialize MPI and set rank parameters */
-  MPI_Init(&argc,&argv);
+  MPI_Init_thread(&argc,&argv,MPI_THREAD_FUNNELED,&thread_support);
   MPI_Comm_rank(MPI_COMM_WORLD,&rank);
   MPI_Comm_size(MPI_COMM_WORLD,&n_ranks);
+  if(thread_support < MPI_THREAD_FUNNELED) {
+    if(rank == 0) fprintf(stderr, "The MPI library does not support threads\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
   iroot = 0;
-  subN2 = N2/n_ranks;
-  subVOLUME = VOLUME/n_ranks;
-  subVOLUMEd2 = subVOLUME/2;
+  subN2 = N2/n_ranks + (rank < N2%n_ranks);
+  j_offset = rank*(N2/n_ranks) + (rank < N2%n_ranks ? rank : N2%n_ranks);
+  subVOLUME = N1*subN2;
+  if(N2 < 2*n_ranks) {
+    if(rank == 0) fprintf(stderr, "Need at least two rows per rank\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
   nextup = (rank+1)%n_ranks; nextdn = (rank-1+n_ranks)%n_ranks;
 
   /* Read parameters. Beta is the inverse of the temperature. */
@@ -51,129 +200,105 @@ int main(int argc, char** argv) {
     FILE *fp = fopen("parameter","r");
     fscanf(fp,"beta %f\n", &beta);
     fscanf(fp,"iter %d\n", &iter);
+    if(fscanf(fp,"checkpoint %d\n", &checkpoint_every) != 1) checkpoint_every = 0;
+    if(fscanf(fp,"restart %d\n", &restart) != 1) restart = 0;
     fclose(fp);
     printf("Beta = %f\n", beta);
     printf("Iter = %d\n", iter);
+    if(checkpoint_every > 0) printf("Checkpoint every %d iterations\n", checkpoint_every);
   }
 
   /* Broadcast parameters to all ranks */
   MPI_Bcast( &beta, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
   MPI_Bcast( &iter, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast( &checkpoint_every, 1, MPI_INT, 0, MPI_COMM_WORLD);
+  MPI_Bcast( &restart, 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-  /* Set random seed for erand. Needs to be different for each rank */
-  seed[0]=12+rank; seed[1]=35+rank; seed[2]=17+rank;
-
-  /* Initialize each point randomly */
-  for(i = 0;i < subVOLUME;i++) {
-    if (erand48(seed) < 0.5)
-      s[i] = 1.0; 
-    else
-      s[i] = -1.0;
+  /* Initialize each point randomly. The sites are numbered as in
+     ising2d4.c, colour by colour, row after row. */
+  for(int parity = 0;parity < 2;parity++) {
+    s[parity] = malloc((subN2+2)*ROW);
+    for(j = 0;j < subN2;j++) for(i = 0;i < N1d2;i++) {
+      if (philox_uniform(SEED, 0, parity*VOLUMEd2 + (j+j_offset)*N1d2 + i) < 0.5)
+        SPIN(s[parity],j,i) = 1;
+      else
+        SPIN(s[parity],j,i) = -1;
+    }
+    pad_rows(s[parity],subN2);
   }
 
-  /* Create and index of neighbours
-     The sites are partitioned to even an odd,
-     with even sites first in the array */
-  for(j = 0;j < subN2;j++) for(i = 0;i < N1;i++) {
-    int ij = i + j;
-    int i2 = i/2;
-    int is = i2 + j*N1d2;
-    if(ij == (2*(ij/2))) {
-	    xup[is] = ((i+1)/2)%N1d2 + j*N1d2 + subVOLUMEd2;
-	    yup[is] = i2 + ((j+1)%subN2)*N1d2 + subVOLUMEd2;
-	    xdn[is] = ((i-1+N1*2)/2)%N1d2 + j*N1d2 + subVOLUMEd2;
-	    ydn[is] = i2 + ((j-1+N2)%subN2)*N1d2 + subVOLUMEd2;
-    }
-    else {
-	    xup[is+subVOLUMEd2] = ((i+1)/2)%N1d2 + j*N1d2;
-	    yup[is+subVOLUMEd2] = i2 + ((j+1)%subN2)*N1d2;
-	    xdn[is+subVOLUMEd2] = ((i-1+N1)/2)%N1d2 + j*N1d2;
-	    ydn[is+subVOLUMEd2] = i2 + ((j-1+N2)%subN2)*N1d2;
-    }
+  /* Persistent requests that fill the ghost rows of each colour. The
+     last row goes to the ghost row -1 of the rank above and the first
+     row to the ghost row subN2 of the rank below. */
+  for(int parity = 0;parity < 2;parity++) {
+    MPI_Recv_init(&SPIN(s[parity],-1,0),N1d2,MPI_SIGNED_CHAR,nextdn,11,MPI_COMM_WORLD,&ghost[parity][0]);
+    MPI_Recv_init(&SPIN(s[parity],subN2,0),N1d2,MPI_SIGNED_CHAR,nextup,22,MPI_COMM_WORLD,&ghost[parity][1]);
+    MPI_Send_init(&SPIN(s[parity],subN2-1,0),N1d2,MPI_SIGNED_CHAR,nextup,11,MPI_COMM_WORLD,&ghost[parity][2]);
+    MPI_Send_init(&SPIN(s[parity],0,0),N1d2,MPI_SIGNED_CHAR,nextdn,22,MPI_COMM_WORLD,&ghost[parity][3]);
   }
 
   /* Initialize the measurements */
   esumt = 0.0;
   magt = 0.0;
+  n_start = 0;
+
+  /* The rows of this rank in the order of the file */
+  lattice = malloc(subVOLUME*sizeof(float));
+  pending = 0;
+
+  /* Continue from a checkpoint. Each rank reads its own rows. */
+  if(restart) {
+    if(MPI_File_open(MPI_COMM_WORLD,CHECKPOINT_FILE,MPI_MODE_RDONLY,MPI_INFO_NULL,&file) != MPI_SUCCESS) {
+      if(rank == 0) fprintf(stderr, "Could not open %s\n", CHECKPOINT_FILE);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_read_at_all(file,0,&header,sizeof(header),MPI_BYTE,MPI_STATUS_IGNORE);
+    if(strncmp(header.magic,"ISING",sizeof(header.magic)) != 0 || header.n1 != N1 || header.n2 != N2
+       || header.seed != SEED) {
+      if(rank == 0) fprintf(stderr, "%s is not a checkpoint of this lattice\n", CHECKPOINT_FILE);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    if(header.beta != beta) {
+      if(rank == 0) fprintf(stderr, "%s was written at beta = %f, not %f\n", CHECKPOINT_FILE, header.beta, beta);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_File_read_at_all(file,sizeof(header)+(MPI_Offset)j_offset*N1*sizeof(float),
+                         lattice,subVOLUME,MPI_FLOAT,MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    from_natural(s,lattice,subN2,j_offset);
+
+    n_start = header.iterations;
+    esumt = header.esumt;
+    magt = header.magt;
+    if(rank == 0) printf("Restarting after iteration %d\n", n_start);
+  }
 
   /* Run a number of iterations */
-  for(n = 0;n < iter;n++) {
+  for(n = n_start;n < iter;n++) {
     esum = 0.0;
     mag = 0.0;
     esumsub = 0.0;
     magsub = 0.0;
+    set_boltzmann(beta);
 
     /* Do for even and odd sites */
     for(int parity=0; parity<2; parity++) {
-      int other_parity = 1 - parity;
-      
-      /* Communicate and update the j=0 boundary */
-      itag = 11;
-      ii = parity*subVOLUMEd2;
-      for(i = 0;i < N1d2;i++) {
-	      sendbuf[i] = s[i+subVOLUMEd2-N1d2+other_parity*subVOLUMEd2];
-      }
-      MPI_Irecv(&recvbuf,N1d2,MPI_FLOAT,nextdn,itag,MPI_COMM_WORLD,&request);
-      MPI_Send(&sendbuf,N1d2,MPI_FLOAT,nextup,itag,MPI_COMM_WORLD);
-      MPI_Wait(&request,&status);
-
-      for(i=0; i<N1d2; i++){
-        float neighbours = s[xup[i+ii]] + s[yup[i+ii]]
-	                     + s[xdn[i+ii]] + recvbuf[i];
-	      stmp = -s[i+ii];
-        energy_now = -s[i+ii]*neighbours;
-        new_energy = -stmp*neighbours;
-        deltae = new_energy-energy_now;
-	      if(exp(-beta*deltae) > erand48(seed)) {
-	        s[i+ii] = stmp;
-	        energy_now = new_energy;
-	      }
-	      magsub = magsub + s[i+ii];
-	      esumsub = esumsub + energy_now;
-      }
+      signed char *c = s[parity], *other = s[1-parity];
+      int esum_sites = 0, mag_sites = 0;
 
-      /* Update the bulk of the lattice, everything but the boundaries */
-      for(j = 1;j < (subN2-1);j++) 
-	      for(i = 0;i < N1d2;i++) {
-	        is = i + N1d2*j + ii;
-	        float neighbours = s[xup[is]] + s[yup[is]]
-                         + s[xdn[is]] + s[ydn[is]];
-	        stmp = -s[is];
-          energy_now = -s[is]*neighbours;
-          new_energy = -stmp*neighbours;
-          deltae = new_energy-energy_now;
-	        if(exp(-beta*deltae) > erand48(seed)) {
-	          s[is] = stmp;
-	          energy_now = new_energy;
-	        }
-	        magsub = magsub + s[is];
-	        esumsub = esumsub + energy_now;
-	      }
-      
-      /* Update the j = subN2-1 boundary */
-      itag = 22;
-      for(i = 0;i < N1d2;i++) {
-	      sendbuf[i] = s[i+other_parity*subVOLUMEd2];
-      }
-      MPI_Irecv(&recvbuf,N1d2,MPI_FLOAT,nextup,itag,MPI_COMM_WORLD,&request);
-      MPI_Send(&sendbuf,N1d2,MPI_FLOAT,nextdn,itag,MPI_COMM_WORLD);
-      MPI_Wait(&request,&status);
-
-      ii = ii+subVOLUMEd2-N1d2;
-      for(i = 0;i < N1d2;i++) {
-	      float neighbours = s[xup[i+ii]] + recvbuf[i]
-	                     + s[xdn[i+ii]] + s[ydn[i+ii]];
-	      stmp = -s[i+ii];
-        energy_now = -s[i+ii]*neighbours;
-        new_energy = -stmp*neighbours;
-        deltae = new_energy-energy_now;
-	      if(exp(-beta*deltae) > erand48(seed)) {
-	        s[i+ii] = stmp;
-	        energy_now = new_energy;
-	      }
-	      magsub = magsub + s[i+ii];
-	      esumsub = esumsub + energy_now;
-      }
+      /* Start filling the ghost rows of the other colour and update
+         the rows that do not need them in the meantime */
+      MPI_Startall(4,ghost[1-parity]);
+      update_rows(c,other,parity,n,j_offset,1,subN2-1,&esum_sites,&mag_sites);
+
+      /* Then the first and the last row */
+      MPI_Waitall(4,ghost[1-parity],MPI_STATUSES_IGNORE);
+      update_rows(c,other,parity,n,j_offset,0,1,&esum_sites,&mag_sites);
+      update_rows(c,other,parity,n,j_offset,subN2-1,subN2,&esum_sites,&mag_sites);
+
+      pad_rows(c,subN2);
+      esumsub = esumsub + esum_sites;
+      magsub = magsub + mag_sites;
 
       /* Sum the energy and magnetisation over the ranks */
       MPI_Reduce(&esumsub,&esum,1,MPI_DOUBLE,MPI_SUM,iroot,MPI_COMM_WORLD);
@@ -189,6 +314,41 @@ int main(int argc, char** argv) {
 
       printf("average energy = %f, average magnetization = %f\n",esum,mag);
     }
+
+    /* Save the state in the background. The previous checkpoint is
+       replaced once the new one is complete. */
+    if(checkpoint_every > 0 && (n+1)%checkpoint_every == 0) {
+      if(pending) {
+        MPI_Wait(&file_request,MPI_STATUS_IGNORE);
+        MPI_File_close(&file);
+        MPI_Barrier(MPI_COMM_WORLD);
+        if(rank == 0) rename(CHECKPOINT_FILE ".partial",CHECKPOINT_FILE);
+      }
+
+      MPI_File_open(MPI_COMM_WORLD,CHECKPOINT_FILE ".partial",MPI_MODE_CREATE|MPI_MODE_WRONLY,
+                    MPI_INFO_NULL,&file);
+      if(rank == 0) {
+        memset(&header,0,sizeof(header));
+        strcpy(header.magic,"ISING");
+        header.n1 = N1; header.n2 = N2;
+        header.iterations = n+1;
+        header.seed = SEED;
+        header.beta = beta;
+        header.esumt = esumt; header.magt = magt;
+        MPI_File_write_at(file,0,&header,sizeof(header),MPI_BYTE,MPI_STATUS_IGNORE);
+      }
+      to_natural(lattice,s,subN2,j_offset);
+      MPI_File_iwrite_at_all(file,sizeof(header)+(MPI_Offset)j_offset*N1*sizeof(float),
+                             lattice,subVOLUME,MPI_FLOAT,&file_request);
+      pending = 1;
+    }
+  }
+
+  if(pending) {
+    MPI_Wait(&file_request,MPI_STATUS_IGNORE);
+    MPI_File_close(&file);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(rank == 0) rename(CHECKPOINT_FILE ".partial",CHECKPOINT_FILE);
   }
 
   esumt = esumt/iter;
@@ -198,5 +358,10 @@ int main(int argc, char** argv) {
     printf("average energy = %f, average magnetization = %f\n", esumt, magt);
   }
 
+  for(int parity = 0;parity < 2;parity++)
+    for(i = 0;i < 4;i++) MPI_Request_free(&ghost[parity][i]);
+  free(s[0]);
+  free(s[1]);
+  free(lattice);
   return MPI_Finalize();
 }
@@ -26,22 +26,26 @@ c     a divisor of n2 and n2/numtask is an even integer for convenience
 
       double precision esumt,magt,magsub,esumsub,esum,mag
 
-      integer*2 seed(3)
-      common/seeds/seed
+c     the random number of a site is keyed by the seed, the sweep and
+c     the global index of the site, so the results do not depend on
+c     the number of nodes (see philox.c)
+      double precision philox_uniform
+      external philox_uniform
+      integer*8 iseed,isweep,isite,ioffset
 
       call MPI_Init(ierr)
 
       call MPI_Comm_rank(MPI_COMM_WORLD,node,ierr)
       call MPI_Comm_size(MPI_COMM_WORLD,numtask,ierr)
 
-      seed(1) = 1225 + node
-      seed(2) = 4739 + node
-      seed(3) = 9753 + node
+      iseed = 1225
 
       iroot = 0
       n2sub = n2/numtask
       ip2sub = n1x2*n2sub
       ip2d2sub = ip2sub/2
+c     the index of the first site of this node in a colour
+      ioffset = node*n2sub*n1
 
       read(12,*) beta, iter
 
@@ -59,10 +63,10 @@ c     a divisor of n2 and n2/numtask is an even integer for convenience
 
 c      write(6,*) 'node = ', node, nextup, nextdn
       
-      call ranset(seed)
-
+      isweep = 0
       do i = 1, ip2sub
-         if(ranf() .lt. 0.5) then
+         isite = ((i-1)/ip2d2sub)*ip2d2 + ioffset + mod(i-1,ip2d2sub)
+         if(philox_uniform(iseed,isweep,isite) .lt. 0.5) then
             s(i) = 1.0
          else
             s(i) = -1.0
@@ -110,6 +114,7 @@ c      write(6,*) 'node = ', node, nextup, nextdn
 
          do ieo = 0, 1
             ioe = 1 - ieo
+            isweep = 2*(n-1) + ieo + 1
             
 c     j = 1 boundary
 
@@ -129,13 +134,15 @@ c     j = 1 boundary
             call MPI_WAIT(ireq,istatus,ierr)
             
             do i = 1, n1
+               isite = ioffset + i-1
                env = s(iup(i+ii,1))+s(iup(i+ii,2))
      #              +s(idn(i+ii,1))+recvbuf(i)
                energy0 = -beta*s(i+ii)*env
                stmp = -s(i+ii)
                energy = -beta*stmp*env
                deltae = energy0-energy
-               if(exp(deltae) .gt. ranf()) then
+               if(exp(deltae) .gt.
+     #              philox_uniform(iseed,isweep,isite)) then
                   s(i+ii) = stmp
                   energy0 = energy
                endif
@@ -146,13 +153,15 @@ c     j = 1 boundary
             do j = 2, n2sub-1
                do i = 1, n1
                   is = i + n1*(j-1) + ii
+                  isite = ioffset + is-ii-1
                   env = s(iup(is,1))+s(iup(is,2))
      #                 +s(idn(is,1))+s(idn(is,2))
                   energy0 = -beta*s(is)*env
                   stmp = -s(is)
                   energy = -beta*stmp*env
                   deltae = energy0-energy
-                  if(exp(deltae) .gt. ranf()) then
+                  if(exp(deltae) .gt.
+     #              philox_uniform(iseed,isweep,isite)) then
                      s(is) = stmp
                      energy0 = energy
                   endif
@@ -179,13 +188,15 @@ c     j = n2sub boundary
 
             ii = ii+ip2d2sub-n1
             do i = 1, n1
+               isite = ioffset + ip2d2sub-n1 + i-1
                env = s(iup(i+ii,1))+recvbuf(i)
      #              +s(idn(i+ii,1))+s(idn(i+ii,2))
                energy0 = -beta*s(i+ii)*env
                stmp = -s(i+ii)
                energy = -beta*stmp*env
                deltae = energy0-energy
-               if(exp(deltae) .gt. ranf()) then
+               if(exp(deltae) .gt.
+     #              philox_uniform(iseed,isweep,isite)) then
                   s(i+ii) = stmp
                   energy0 = energy
                endif
@@ -0,0 +1,281 @@
+/* multi-spin coded parallel code for ising model */
+
+/* contact seyong.kim81@gmail.com for comments and questions */
+
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <mpi.h>
+
+#include "philox.h"
+
+/* N1 must be a multiple of 128, so that every strip below has an
+   even width */
+#define N1 384
+#define N2 384
+
+#define VOLUME (N1*N2)
+
+/* The lattice is cut into 64 strips of STRIP columns. Bit b of a
+   word holds the spin at the same place in strip b, so one word
+   updates 64 spins at once. With an even strip width the spins of
+   a word all have the same colour, and a row of one colour takes
+   WORDS words. */
+#define STRIP (N1/64)
+#define WORDS (STRIP/2)
+
+/* Binary digits of the acceptance probabilities */
+#define DIGITS 24
+
+/* The seed of the random numbers */
+#define SEED 1225
+
+/*  2d Ising model using Metropolis update algorithm
+    periodic boundary condition for x- and y-direction
+    version 4 : multi-spin coded, 64 spins of one colour per word.
+    A set bit is spin +1, a clear bit -1.
+    MPI version
+    assumes a 1-D ring topology in the y direction, with the rows
+    split as in ising2d4_mpi.c. Runs on a single rank as well.
+    Compile with
+      mpicc -O3 -o ising2d4_msc ising2d4_msc.c philox.c -lm
+    The random words come from the counter based generator of
+    philox.c, keyed by the sweep and the global index of the word,
+    so a run gives the same results on any number of ranks.
+    The energy and magnetization are measured after each sweep. */
+
+
+/* The random words of one word of spins in a sweep. The counter of
+   Philox holds the global index of the word, the number of the draw
+   and the sweep, and each call gives two words. */
+typedef struct {
+  uint64_t sweep;
+  uint32_t word;
+  uint32_t draw;
+  uint32_t block[4];
+} word_stream;
+
+static void start_stream(word_stream *r, uint64_t sweep, uint32_t word) {
+  r->sweep = sweep;
+  r->word = word;
+  r->draw = 0;
+}
+
+static uint64_t random_word(word_stream *r) {
+  const uint32_t key[2] = { (uint32_t)SEED, (uint32_t)((uint64_t)SEED >> 32) };
+  uint32_t *half;
+
+  if(r->draw%2 == 0) {
+    r->block[0] = r->word;
+    r->block[1] = r->draw/2;
+    r->block[2] = (uint32_t)r->sweep;
+    r->block[3] = (uint32_t)(r->sweep >> 32);
+    philox4x32(r->block, key);
+  }
+  half = r->block + 2*(r->draw++%2);
+  return half[0] | (uint64_t)half[1] << 32;
+}
+
+/* A word whose bits are independently set with the probability
+   0.d[0]d[1]d[2]... in binary, for the bits set in needed, and clear
+   elsewhere. Each random word is the next binary digit of a uniform
+   number for every bit, starting from the first. A bit is decided
+   at the first digit where its number differs from the probability,
+   so usually only a few words are drawn. */
+static uint64_t random_mask(word_stream *r, const int digit[DIGITS], uint64_t needed) {
+  uint64_t mask = 0, undecided = needed;
+  for(int k = 0; k < DIGITS && undecided; k++) {
+    uint64_t w = random_word(r);
+    if(digit[k]) {
+      mask |= undecided & ~w;
+      undecided &= w;
+    } else {
+      undecided &= ~w;
+    }
+  }
+  return mask;
+}
+
+/* The global index of word x of local row j of a colour. Row j of
+   the arrays is the local row j-1. */
+static uint32_t word_index(int colour, int j, int x, int j_offset) {
+  return ((uint32_t)colour*N2 + j-1 + j_offset)*WORDS + x;
+}
+
+/* The neighbour in the previous and in the next strip */
+static uint64_t from_previous_strip(uint64_t w) { return (w << 1) | (w >> 63); }
+static uint64_t from_next_strip(uint64_t w) { return (w >> 1) | (w << 63); }
+
+/* Count the set bits of a word */
+static int count_bits(uint64_t w) { return __builtin_popcountll(w); }
+
+
+int main(int argc, char** argv) {
+
+  int n,i,j,x,iter,parity;
+  int rank, n_ranks, nextup, nextdn, iroot, subN2, j_offset;
+  int digit[DIGITS];
+  uint64_t (*s[2])[WORDS];
+  float beta;
+  double p4, esumt, magt, esum, mag, sums[2], local[2];
+
+  /* Initialize MPI and set rank parameters */
+  MPI_Init(&argc,&argv);
+  MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+  MPI_Comm_size(MPI_COMM_WORLD,&n_ranks);
+  iroot = 0;
+  subN2 = N2/n_ranks + (rank < N2%n_ranks);
+  j_offset = rank*(N2/n_ranks) + (rank < N2%n_ranks ? rank : N2%n_ranks);
+  if(N2 < 2*n_ranks) {
+    if(rank == 0) fprintf(stderr, "Need at least two rows per rank\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  nextup = (rank+1)%n_ranks; nextdn = (rank-1+n_ranks)%n_ranks;
+
+  /* Read parameters. Beta is the inverse of the temperature. */
+  if(rank == 0){
+    FILE *fp = fopen("parameter","r");
+    fscanf(fp,"beta %f\n", &beta);
+    fscanf(fp,"iter %d\n", &iter);
+    fclose(fp);
+    printf("Beta = %f\n", beta);
+    printf("Iter = %d\n", iter);
+  }
+
+  /* Broadcast parameters to all ranks */
+  MPI_Bcast( &beta, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+  MPI_Bcast( &iter, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+  /* A flip that raises the energy by 4 is accepted with the
+     probability p4, one that raises it by 8 with p4*p4. Keep the
+     binary digits of p4. */
+  p4 = exp(-4*beta);
+  for(i = 0;i < DIGITS;i++) {
+    p4 *= 2;
+    digit[i] = p4 >= 1;
+    if(digit[i]) p4 -= 1;
+  }
+
+  /* The rows of each colour, with a ghost row on either side.
+     Row j of the array is the local row j-1. */
+  for(parity = 0;parity < 2;parity++)
+    s[parity] = malloc((subN2+2)*sizeof(*s[parity]));
+
+  /* Initialize each point randomly, with the random words of sweep 0 */
+  for(parity = 0;parity < 2;parity++)
+    for(j = 1;j <= subN2;j++) for(x = 0;x < WORDS;x++) {
+      word_stream r;
+      start_stream(&r, 0, word_index(parity, j, x, j_offset));
+      s[parity][j][x] = random_word(&r);
+    }
+
+  /* Initialize the measurements */
+  esumt = 0.0;
+  magt = 0.0;
+
+  /* Run a number of iterations */
+  for(n = 0;n < iter;n++) {
+
+    /* Update the two colours in turn, and bring the ghost rows of
+       the colour used in the measurement up to date at the end */
+    for(parity = 0;parity < 3;parity++) {
+      int colour = parity%2, other = 1-colour;
+      uint64_t (*u)[WORDS] = s[colour], (*v)[WORDS] = s[other];
+
+      /* The neighbours of this colour are in the rows of the other
+         one. A row is WORDS words, 32 times less than the floats. */
+      MPI_Sendrecv(v[subN2],WORDS,MPI_UINT64_T,nextup,11,
+                   v[0],WORDS,MPI_UINT64_T,nextdn,11,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+      MPI_Sendrecv(v[1],WORDS,MPI_UINT64_T,nextdn,22,
+                   v[subN2+1],WORDS,MPI_UINT64_T,nextup,22,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+      if(parity == 2) break;
+
+      for(j = 1;j <= subN2;j++) {
+        /* The first site of this colour in a strip row is at
+           column 0 or 1 */
+        int shift = (colour + j-1 + j_offset)%2;
+        for(x = 0;x < WORDS;x++) {
+          uint64_t left, right, a1, a2, a3, a4;
+          uint64_t s1, s2, c1, c2, c3, odd, two_or_more, flip;
+
+          if(shift == 0) {
+            right = v[j][x];
+            left = x > 0 ? v[j][x-1] : from_previous_strip(v[j][WORDS-1]);
+          } else {
+            left = v[j][x];
+            right = x < WORDS-1 ? v[j][x+1] : from_next_strip(v[j][0]);
+          }
+
+          /* Count the neighbours pointing the other way, as a bit
+             sliced number. The flip lowers the energy if two or
+             more do. */
+          a1 = u[j][x] ^ left;  a2 = u[j][x] ^ right;
+          a3 = u[j][x] ^ v[j-1][x];  a4 = u[j][x] ^ v[j+1][x];
+          s1 = a1 ^ a2;  c1 = a1 & a2;
+          s2 = a3 ^ a4;  c2 = a3 & a4;
+          odd = s1 ^ s2;  c3 = s1 & s2;
+          two_or_more = c1 | c2 | c3;
+
+          /* One other way raises the energy by 4, none by 8. The
+             half sweeps of the colours count as the sweeps of the
+             random words. */
+          flip = two_or_more;
+          if(~two_or_more) {
+            uint64_t one = odd & ~two_or_more, none = ~odd & ~two_or_more;
+            uint64_t p8;
+            word_stream r;
+            start_stream(&r, 2*(uint64_t)n + colour + 1, word_index(colour, j, x, j_offset));
+            p8 = random_mask(&r, digit, none);
+            flip |= random_mask(&r, digit, one | p8);
+          }
+          u[j][x] ^= flip;
+        }
+      }
+    }
+
+    /* Every bond has one end of colour 0. Count the bonds between
+       opposite spins and the spins up. */
+    local[0] = 0.0;
+    local[1] = 0.0;
+    for(j = 1;j <= subN2;j++) {
+      int shift = (j-1 + j_offset)%2;
+      for(x = 0;x < WORDS;x++) {
+        uint64_t left, right, w = s[0][j][x];
+        if(shift == 0) {
+          right = s[1][j][x];
+          left = x > 0 ? s[1][j][x-1] : from_previous_strip(s[1][j][WORDS-1]);
+        } else {
+          left = s[1][j][x];
+          right = x < WORDS-1 ? s[1][j][x+1] : from_next_strip(s[1][j][0]);
+        }
+        local[0] += count_bits(w ^ left) + count_bits(w ^ right)
+                  + count_bits(w ^ s[1][j-1][x]) + count_bits(w ^ s[1][j+1][x]);
+        local[1] += count_bits(w) + count_bits(s[1][j][x]);
+      }
+    }
+    MPI_Reduce(local,sums,2,MPI_DOUBLE,MPI_SUM,iroot,MPI_COMM_WORLD);
+
+    /* Calculate average measurements and print. The energy of a site
+       is that of its four bonds, as in the other versions. */
+    if(rank == 0) {
+      esum = 4*sums[0]/VOLUME - 4.0;
+      mag = (2*sums[1] - VOLUME)/VOLUME;
+      esumt = esumt + esum;
+      magt = magt + fabs(mag);
+
+      printf("average energy = %f, average magnetization = %f\n",esum,mag);
+    }
+  }
+
+  esumt = esumt/iter;
+  magt = magt/iter;
+  if(rank == 0){
+    printf("Over the whole simulation:\n");
+    printf("average energy = %f, average magnetization = %f\n", esumt, magt);
+  }
+
+  for(parity = 0;parity < 2;parity++) free(s[parity]);
+  return MPI_Finalize();
+}
@@ -0,0 +1,99 @@
+/* Counter based random numbers for the Ising codes */
+
+/* Compile together with the C codes, or with ranf.c for the Fortran
+   ones. Four sites share a counter, site/4, and take one of its four
+   words each. */
+
+#include "philox.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+/* A 32 bit word as a double in [0,1) */
+#define TO_UNIFORM(x) ((x) * (1.0/4294967296.0))
+
+
+/* Replace the counter by the four random words it maps to */
+void philox4x32( uint32_t counter[4], const uint32_t key[2] ){
+  uint32_t k0 = key[0], k1 = key[1];
+
+  for( int r=0; r<PHILOX_ROUNDS; r++ ){
+    uint64_t p0 = (uint64_t)PHILOX_M0 * counter[0];
+    uint64_t p1 = (uint64_t)PHILOX_M1 * counter[2];
+    uint32_t c1 = counter[1], c3 = counter[3];
+
+    counter[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+    counter[1] = (uint32_t)p1;
+    counter[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+    counter[3] = (uint32_t)p0;
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+}
+
+
+/* The uniform random number of a site in a sweep */
+double philox_uniform( uint64_t seed, uint64_t sweep, uint64_t site ){
+  uint32_t key[2] = { (uint32_t)seed, (uint32_t)(seed >> 32) };
+  uint64_t block = site / 4;
+  uint32_t counter[4] = { (uint32_t)block, (uint32_t)(block >> 32),
+                          (uint32_t)sweep, (uint32_t)(sweep >> 32) };
+
+  philox4x32( counter, key );
+  return TO_UNIFORM( counter[site % 4] );
+}
+
+
+/* The numbers of the n sites from first_site on, the same as
+   philox_uniform gives one at a time. The counters are independent,
+   so the compiler can run the rounds of several of them in the lanes
+   of the vector registers. */
+void philox_uniforms( uint64_t seed, uint64_t sweep, uint64_t first_site, int n, double *u ){
+  uint32_t k0 = (uint32_t)seed, k1 = (uint32_t)(seed >> 32);
+  uint32_t s0 = (uint32_t)sweep, s1 = (uint32_t)(sweep >> 32);
+  int i = 0;
+
+  // The sites before the first full block of four
+  for( ; i < n && (first_site + i) % 4 != 0; i++ )
+    u[i] = philox_uniform( seed, sweep, first_site + i );
+
+  // The full blocks
+  int n_blocks = (n - i) / 4;
+  uint64_t first_block = (first_site + i) / 4;
+  double *out = u + i;
+  for( int b=0; b < n_blocks; b++ ){
+    uint64_t block = first_block + b;
+    uint32_t c0 = (uint32_t)block, c1 = (uint32_t)(block >> 32), c2 = s0, c3 = s1;
+    uint32_t key0 = k0, key1 = k1;
+
+    for( int r=0; r<PHILOX_ROUNDS; r++ ){
+      uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+      uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+      c0 = (uint32_t)(p1 >> 32) ^ c1 ^ key0;
+      c1 = (uint32_t)p1;
+      c2 = (uint32_t)(p0 >> 32) ^ c3 ^ key1;
+      c3 = (uint32_t)p0;
+      key0 += PHILOX_W0;
+      key1 += PHILOX_W1;
+    }
+    out[4*b] = TO_UNIFORM( c0 );
+    out[4*b+1] = TO_UNIFORM( c1 );
+    out[4*b+2] = TO_UNIFORM( c2 );
+    out[4*b+3] = TO_UNIFORM( c3 );
+  }
+  i += 4*n_blocks;
+
+  // And the rest
+  for( ; i < n; i++ )
+    u[i] = philox_uniform( seed, sweep, first_site + i );
+}
+
+
+/* Fortran binding, double precision function philox_uniform(seed,
+   sweep, site) with integer*8 arguments */
+double philox_uniform_( const int64_t *seed, const int64_t *sweep, const int64_t *site ){
+  return philox_uniform( (uint64_t)*seed, (uint64_t)*sweep, (uint64_t)*site );
+}
@@ -0,0 +1,19 @@
+/* Counter based random numbers for the Ising codes */
+
+#ifndef PHILOX_H
+#define PHILOX_H
+
+#include <stdint.h>
+
+/* The Philox4x32-10 generator of Salmon et al., "Parallel random
+   numbers: as easy as 1, 2, 3" (SC11). It maps a 128 bit counter and
+   a 64 bit key to four random 32 bit words, with no state in
+   between. Here the key is the seed of the run and the counter the
+   sweep and the global index of the site, so each site gets the same
+   number in a sweep whatever rank or thread updates it. */
+
+void philox4x32( uint32_t counter[4], const uint32_t key[2] );
+double philox_uniform( uint64_t seed, uint64_t sweep, uint64_t site );
+void philox_uniforms( uint64_t seed, uint64_t sweep, uint64_t first_site, int n, double *u );
+
+#endif
@@ -1,63 +1,70 @@
-/*  -- translated by f2c (version 19970805).
-   You must link the resulting object file with the libraries:
-	-lf2c -lm   (in that order)
-*/
-
-#include "f2c.h"
-
-/* Common Block Declarations */
-
-struct {
-    shortint inseed[3];
-} seeds_;
-
-#define seeds_1 seeds_
-
-doublereal ranf_()
-{
-    /* System generated locals */
-    real ret_val;
-
-    /* Local variables */
-    extern doublereal erand48();
-
-    ret_val = erand48(seeds_1.inseed);
-    return ret_val;
-} /* ranf_ */
-
-
-
-
-/* Subroutine */ int ranset_(jseed)
-shortint *jseed;
-{
-    static integer i__;
-
-    /* Parameter adjustments */
-    --jseed;
-
-    /* Function Body */
-    for (i__ = 1; i__ <= 3; ++i__) {
-	seeds_1.inseed[i__ - 1] = jseed[i__];
-    }
-    return 0;
-} /* ranset_ */
-
-
-
-
-/* Subroutine */ int ranget_(jseed)
-shortint *jseed;
-{
-    static integer i__;
-
-    /* Parameter adjustments */
-    --jseed;
-
-    /* Function Body */
-    for (i__ = 1; i__ <= 3; ++i__) {
-	jseed[i__] = seeds_1.inseed[i__ - 1];
-    }
-    return 0;
-} /* ranget_ */
-
+/* Random numbers for the Fortran codes, on the counter based
+   generator of philox.c */
+
+/* Compile with
+     gcc -c ranf.c philox.c
+   and link the objects to the Fortran program.
+
+   ranf() returns the next number of the stream of the calling thread.
+   The stream is keyed by a seed and by the OpenMP thread number, so
+   the threads draw different numbers even from the same seed. Its
+   state is two integer*8 words, the seed and the number of values
+   drawn: ranget(state) saves it and ranset(state) continues from it,
+   so a saved stream carries on where it was instead of repeating the
+   numbers already drawn. ranset with a zero count starts a seed from
+   its beginning.
+
+   The order in which ranf is called still decides which site gets
+   which number. The Ising codes call philox_uniform(seed, sweep,
+   site) instead, which numbers the draws by site. */
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#else
+#define omp_get_thread_num() 0
+#endif
+
+#include "philox.h"
+
+/* The stream of a thread: the seed, the number of values drawn and
+   the last block of four */
+static _Thread_local struct {
+  uint64_t seed;
+  uint64_t drawn;
+  uint64_t block;
+  uint32_t words[4];
+  int valid;
+} stream;
+
+
+double ranf_( void ){
+  uint64_t block = stream.drawn / 4;
+
+  if( !stream.valid || block != stream.block ){
+    uint32_t key[2] = { (uint32_t)stream.seed, (uint32_t)omp_get_thread_num() };
+    stream.words[0] = (uint32_t)block;
+    stream.words[1] = (uint32_t)(block >> 32);
+    stream.words[2] = (uint32_t)(stream.seed >> 32);
+    stream.words[3] = 0;
+    philox4x32( stream.words, key );
+    stream.block = block;
+    stream.valid = 1;
+  }
+  return stream.words[stream.drawn++ % 4] * (1.0/4294967296.0);
+}
+
+
+int ranset_( const int64_t state[2] ){
+  stream.seed = (uint64_t)state[0];
+  stream.drawn = (uint64_t)state[1];
+  stream.valid = 0;
+  return 0;
+}
+
+
+int ranget_( int64_t state[2] ){
+  state[0] = (int64_t)stream.seed;
+  state[1] = (int64_t)stream.drawn;
+  return 0;
+}
@@ -0,0 +1,334 @@
+/* Conjugate gradient solver for the Poisson equation */
+
+/* The Jacobi update u = (sum of neighbours - hsq*rho)/4 solves the
+   linear system Au = b with (Au)_ji = 4u_ji - sum of neighbours and
+   b = -hsq*rho. A is symmetric and positive definite, so the
+   conjugate gradient method applies. The boundary values in the
+   ghost points of u only enter the first residual. The other
+   vectors are zero on the boundary.
+   The matrix-vector product needs the halo of the vector and each
+   dot product is a sum over all ranks. The standard method has two
+   reductions in each iteration and waits for both. The pipelined
+   variant of Ghysels and Vanroose has a single one, started with
+   MPI_Iallreduce before the preconditioner and the matrix-vector
+   product, which run while the sum is on its way. In exchange it
+   updates four more vectors with recurrences. In single precision
+   their rounding errors grow quickly once the residual is small,
+   so every CG_REPLACE_EVERY iterations they are recomputed from
+   their definitions. For the same reason (p,Ap) is expanded in
+   products of the vectors, instead of using the shorter formula
+   that assumes exact conjugacy. */
+
+#include <string.h>
+
+#include "poisson_cg.h"
+#include "poisson_halo.h"
+
+
+/* Find the preconditioner matching a command line name, -1 if none
+   does */
+int precond_from_name( const char *name ){
+  if( strcmp(name, "none") == 0 ) return PRECOND_NONE;
+  if( strcmp(name, "jacobi") == 0 ) return PRECOND_JACOBI;
+  if( strcmp(name, "ic") == 0 ) return PRECOND_IC;
+  return -1;
+}
+
+
+/* List the vectors used by the method, returns their number */
+static int cg_vectors( cg_t *cg, field_t **list ){
+  int n_vectors = 0;
+  list[n_vectors++] = &cg->r;
+  list[n_vectors++] = &cg->z;
+  list[n_vectors++] = &cg->p;
+  list[n_vectors++] = &cg->s;
+  if( cg->precond == PRECOND_IC ) list[n_vectors++] = &cg->dinv;
+  if( cg->pipelined ){
+    list[n_vectors++] = &cg->w;
+    list[n_vectors++] = &cg->m;
+    list[n_vectors++] = &cg->n;
+    list[n_vectors++] = &cg->q;
+    list[n_vectors++] = &cg->t;
+  }
+  return n_vectors;
+}
+
+
+/* Find the inverse pivots of the incomplete Cholesky factorisation
+   of A restricted to the local block. The factor has the same
+   nonzeros as A, so the pivot of a point only depends on those of
+   its neighbours at i-1 and j-1. The couplings to other ranks are
+   dropped, which makes the preconditioner block diagonal. */
+static void ic_factorise( field_t *dinv ){
+  for( int j=1; j <= dinv->ny; j++ ){
+    for( int i=1; i <= dinv->nx; i++ ){
+      float pivot = 4;
+      if( i > 1 ) pivot -= FIELD(dinv, j, i-1);
+      if( j > 1 ) pivot -= FIELD(dinv, j-1, i);
+      FIELD(dinv, j, i) = 1/pivot;
+    }
+  }
+}
+
+
+/* Allocate the vectors for the local block of the decomposition d.
+   Returns 0 on success. */
+int cg_setup( cg_t *cg, const decomp_t *d, int precond, int pipelined ){
+  field_t *list[10];
+  int n_vectors;
+
+  cg->decomp = d;
+  cg->precond = precond;
+  cg->pipelined = pipelined;
+  cg->iterations = 0;
+  cg->ps = 0;
+  cg->pp = 0;
+
+  n_vectors = cg_vectors( cg, list );
+  for( int v=0; v<n_vectors; v++ ){
+    if( field_alloc( list[v], d->nx, d->ny, 1 ) != 0 ) return -1;
+    field_fill( list[v], 0.0 );
+  }
+
+  if( precond == PRECOND_IC ) ic_factorise( &cg->dinv );
+  return 0;
+}
+
+
+void cg_free( cg_t *cg ){
+  field_t *list[10];
+  int n_vectors = cg_vectors( cg, list );
+  for( int v=0; v<n_vectors; v++ ) field_free( list[v] );
+}
+
+
+/* z = M^-1 r */
+static void precondition( const cg_t *cg, field_t *z, const field_t *r ){
+  int nx = r->nx, ny = r->ny;
+
+  if( cg->precond == PRECOND_NONE ){
+    #pragma omp parallel for schedule(static)
+    for( int j=1; j <= ny; j++ )
+      memcpy( FIELD_ROW(z, j)+1, FIELD_ROW(r, j)+1, nx*sizeof(float) );
+
+  } else if( cg->precond == PRECOND_JACOBI ){
+    #pragma omp parallel for schedule(static)
+    for( int j=1; j <= ny; j++ )
+      for( int i=1; i <= nx; i++ )
+        FIELD(z, j, i) = 0.25*FIELD(r, j, i);
+
+  } else {
+    const field_t *dinv = &cg->dinv;
+
+    // Solve with the lower triangular factor, then with the upper
+    // one. The neighbours outside the block are left out, since the
+    // ghost points of z may hold the halo. Each point depends on the
+    // one before it, so the solves run on a single thread.
+    for( int j=1; j <= ny; j++ ){
+      for( int i=1; i <= nx; i++ ){
+        float sum = FIELD(r, j, i);
+        if( i > 1 ) sum += FIELD(z, j, i-1);
+        if( j > 1 ) sum += FIELD(z, j-1, i);
+        FIELD(z, j, i) = sum*FIELD(dinv, j, i);
+      }
+    }
+    for( int j=ny; j >= 1; j-- ){
+      for( int i=nx; i >= 1; i-- ){
+        float sum = 0;
+        if( i < nx ) sum += FIELD(z, j, i+1);
+        if( j < ny ) sum += FIELD(z, j+1, i);
+        FIELD(z, j, i) += sum*FIELD(dinv, j, i);
+      }
+    }
+  }
+}
+
+
+/* out = A in. The halo of in is exchanged first. */
+static void matvec( const cg_t *cg, field_t *out, field_t *in ){
+  halo_exchange( in, cg->decomp );
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= in->ny; j++ ){
+    const float *up = FIELD_ROW(in, j-1);
+    const float *mid = FIELD_ROW(in, j);
+    const float *down = FIELD_ROW(in, j+1);
+    float *outrow = FIELD_ROW(out, j);
+    for( int i=1; i <= in->nx; i++ ){
+      outrow[i] = 4*mid[i] - ( mid[i-1] + mid[i+1] + up[i] + down[i] );
+    }
+  }
+}
+
+
+/* The local part of the dot product of two vectors */
+static double dot( const field_t *a, const field_t *b ){
+  double sum = 0.0;
+  #pragma omp parallel for schedule(static) reduction(+:sum)
+  for( int j=1; j <= a->ny; j++ ){
+    const float *arow = FIELD_ROW(a, j);
+    const float *brow = FIELD_ROW(b, j);
+    for( int i=1; i <= a->nx; i++ ){
+      sum += arow[i]*brow[i];
+    }
+  }
+  return sum;
+}
+
+
+/* r = b - Au, using the boundary values in the ghost points of u */
+static void initial_residual( const cg_t *cg, field_t *r, field_t *u, const field_t *rho, float hsq ){
+  halo_exchange( u, cg->decomp );
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= u->ny; j++ ){
+    const float *up = FIELD_ROW(u, j-1);
+    const float *mid = FIELD_ROW(u, j);
+    const float *down = FIELD_ROW(u, j+1);
+    const float *rhorow = FIELD_ROW(rho, j);
+    float *rrow = FIELD_ROW(r, j);
+    for( int i=1; i <= u->nx; i++ ){
+      rrow[i] = mid[i-1] + mid[i+1] + up[i] + down[i] - 4*mid[i] - hsq*rhorow[i];
+    }
+  }
+}
+
+
+/* One iteration of the preconditioned conjugate gradient method */
+static double iteration_standard( cg_t *cg, field_t *u ){
+  int nx = u->nx, ny = u->ny;
+  double local[2], global[2];
+  double alpha, beta, gamma;
+
+  // Step along the search direction to the minimum
+  matvec( cg, &cg->s, &cg->p );
+  local[0] = dot( &cg->p, &cg->s );
+  local[1] = dot( &cg->p, &cg->p );
+  MPI_Allreduce( local, global, 2, MPI_DOUBLE, MPI_SUM, cg->decomp->comm );
+  alpha = cg->gamma/global[0];
+
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= ny; j++ ){
+    for( int i=1; i <= nx; i++ ){
+      FIELD(u, j, i) += alpha*FIELD(&cg->p, j, i);
+      FIELD(&cg->r, j, i) -= alpha*FIELD(&cg->s, j, i);
+    }
+  }
+
+  // The next search direction
+  precondition( cg, &cg->z, &cg->r );
+  local[0] = dot( &cg->r, &cg->z );
+  MPI_Allreduce( local, &gamma, 1, MPI_DOUBLE, MPI_SUM, cg->decomp->comm );
+  beta = gamma/cg->gamma;
+  cg->gamma = gamma;
+
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= ny; j++ ){
+    for( int i=1; i <= nx; i++ ){
+      FIELD(&cg->p, j, i) = FIELD(&cg->z, j, i) + beta*FIELD(&cg->p, j, i);
+    }
+  }
+
+  return alpha*alpha*global[1];
+}
+
+
+/* Recompute the vectors of the pipelined method from u and p,
+   along with (p,Ap) and (p,p) */
+static void replace_residual( cg_t *cg, field_t *u, const field_t *rho, float hsq ){
+  double local[2], global[2];
+
+  initial_residual( cg, &cg->r, u, rho, hsq );
+  precondition( cg, &cg->z, &cg->r );
+  matvec( cg, &cg->w, &cg->z );
+  matvec( cg, &cg->s, &cg->p );
+  precondition( cg, &cg->q, &cg->s );
+  matvec( cg, &cg->t, &cg->q );
+
+  local[0] = dot( &cg->p, &cg->s );
+  local[1] = dot( &cg->p, &cg->p );
+  MPI_Allreduce( local, global, 2, MPI_DOUBLE, MPI_SUM, cg->decomp->comm );
+  cg->ps = global[0];
+  cg->pp = global[1];
+}
+
+
+/* One iteration of the pipelined method. Besides r and z it keeps
+   w = Az, s = Ap, q = Ms and t = Aq, so all dot products of the
+   iteration are known at its start. */
+static double iteration_pipelined( cg_t *cg, field_t *u ){
+  int nx = u->nx, ny = u->ny;
+  double local[5], global[5];
+  double alpha, beta, gamma;
+  MPI_Request request;
+
+  // Start the sum of (r,z) and of the products that give (p,Ap) and
+  // (p,p) for the next direction p = z + beta p
+  local[0] = dot( &cg->r, &cg->z );
+  local[1] = dot( &cg->w, &cg->z );
+  local[2] = dot( &cg->z, &cg->s ) + dot( &cg->p, &cg->w );
+  local[3] = dot( &cg->z, &cg->z );
+  local[4] = dot( &cg->z, &cg->p );
+  MPI_Iallreduce( local, global, 5, MPI_DOUBLE, MPI_SUM, cg->decomp->comm, &request );
+
+  // Work on the next vectors while the sum is in flight
+  precondition( cg, &cg->m, &cg->w );
+  matvec( cg, &cg->n, &cg->m );
+
+  MPI_Wait( &request, MPI_STATUS_IGNORE );
+  gamma = global[0];
+  beta = cg->iterations == 0 ? 0 : gamma/cg->gamma;
+  cg->ps = global[1] + beta*global[2] + beta*beta*cg->ps;
+  cg->pp = global[3] + 2*beta*global[4] + beta*beta*cg->pp;
+  alpha = gamma/cg->ps;
+  cg->gamma = gamma;
+
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= ny; j++ ){
+    for( int i=1; i <= nx; i++ ){
+      float t = FIELD(&cg->n, j, i) + beta*FIELD(&cg->t, j, i);
+      float q = FIELD(&cg->m, j, i) + beta*FIELD(&cg->q, j, i);
+      float s = FIELD(&cg->w, j, i) + beta*FIELD(&cg->s, j, i);
+      float p = FIELD(&cg->z, j, i) + beta*FIELD(&cg->p, j, i);
+      FIELD(&cg->t, j, i) = t;
+      FIELD(&cg->q, j, i) = q;
+      FIELD(&cg->s, j, i) = s;
+      FIELD(&cg->p, j, i) = p;
+      FIELD(u, j, i) += alpha*p;
+      FIELD(&cg->r, j, i) -= alpha*s;
+      FIELD(&cg->z, j, i) -= alpha*q;
+      FIELD(&cg->w, j, i) -= alpha*t;
+    }
+  }
+
+  return alpha*alpha*cg->pp;
+}
+
+
+/* Run one iteration on the field u and return the squared change
+   of u summed over the ranks. The first call computes the residual
+   from u, later calls continue from the stored state. */
+double cg_iteration( cg_t *cg, field_t *u, const field_t *rho, float hsq ){
+  double unorm;
+
+  if( cg->iterations == 0 ){
+    initial_residual( cg, &cg->r, u, rho, hsq );
+    precondition( cg, &cg->z, &cg->r );
+    if( cg->pipelined ){
+      matvec( cg, &cg->w, &cg->z );
+    } else {
+      double gamma = dot( &cg->r, &cg->z );
+      MPI_Allreduce( &gamma, &cg->gamma, 1, MPI_DOUBLE, MPI_SUM, cg->decomp->comm );
+      for( int j=1; j <= u->ny; j++ )
+        memcpy( FIELD_ROW(&cg->p, j)+1, FIELD_ROW(&cg->z, j)+1, u->nx*sizeof(float) );
+    }
+  }
+
+  if( cg->pipelined ){
+    if( cg->iterations > 0 && cg->iterations%CG_REPLACE_EVERY == 0 )
+      replace_residual( cg, u, rho, hsq );
+    unorm = iteration_pipelined( cg, u );
+  } else {
+    unorm = iteration_standard( cg, u );
+  }
+  cg->iterations++;
+  return unorm;
+}
@@ -0,0 +1,45 @@
+/* Conjugate gradient solver for the Poisson equation */
+
+#ifndef POISSON_CG_H
+#define POISSON_CG_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+/* Iterations between recomputing the residual in the pipelined
+   variant */
+#define CG_REPLACE_EVERY 50
+
+/* Preconditioners */
+enum {
+  PRECOND_NONE,
+  PRECOND_JACOBI,    // Divide by the diagonal
+  PRECOND_IC         // Incomplete Cholesky of the local block
+};
+
+/* The state of the iteration, kept between calls. The vectors are
+   fields of the local grid, only the interior points are used. */
+typedef struct {
+  const decomp_t *decomp;  // The blocks of the ranks
+  int precond;       // One of the PRECOND_ values
+  int pipelined;     // Use the pipelined variant
+  int iterations;    // The number of iterations run so far
+  double gamma;      // (r,z) of the previous iteration
+  double ps, pp;     // (p,Ap) and (p,p), for the pipelined variant
+  field_t r;         // Residual b - Au
+  field_t z;         // Preconditioned residual Mr
+  field_t p;         // Search direction
+  field_t s;         // Ap
+  field_t w, m, n;   // Az, Mw and Am of the pipelined variant
+  field_t q, t;      // Ms and At of the pipelined variant
+  field_t dinv;      // Inverse pivots of the incomplete Cholesky factor
+} cg_t;
+
+int precond_from_name( const char *name );
+int cg_setup( cg_t *cg, const decomp_t *d, int precond, int pipelined );
+double cg_iteration( cg_t *cg, field_t *u, const field_t *rho, float hsq );
+void cg_free( cg_t *cg );
+
+#endif
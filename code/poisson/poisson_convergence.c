@@ -0,0 +1,70 @@
+/* Convergence checks of the Poisson solver */
+
+/* Summing the change over the ranks in every iteration makes every
+   rank wait for the slowest one each time. Checking less often
+   removes most of the waiting, at the cost of running up to
+   every-1 iterations past the point of convergence. With async the
+   sum is started at a check and only collected at the next one, so
+   the ranks never wait for it, and the run stops one check later. */
+
+#include "poisson_convergence.h"
+
+
+void convergence_init( convergence_t *c, MPI_Comm comm, double residual, int every, int async ){
+  c->comm = comm;
+  c->residual = residual;
+  c->every = every;
+  c->async = async;
+  c->calls = 0;
+  c->pending = 0;
+  c->unorm = 0.0;
+  c->unorm_iteration = -1;
+}
+
+
+/* Record the change unorm of this rank in the given iteration.
+   Returns 1 once the change summed over the ranks is below the
+   residual. The sum is then in c->unorm and the iteration it
+   belongs to in c->unorm_iteration. */
+int convergence_check( convergence_t *c, int iteration, double unorm ){
+  int converged = 0;
+
+  c->calls++;
+  if( c->calls % c->every != 0 ) return 0;
+
+  if( !c->async ){
+    MPI_Allreduce( &unorm, &c->unorm, 1, MPI_DOUBLE, MPI_SUM, c->comm );
+    c->unorm_iteration = iteration;
+    return c->unorm <= c->residual;
+  }
+
+  // Collect the sum started at the previous check, it has had the
+  // iterations in between to arrive
+  if( c->pending ){
+    MPI_Wait( &c->request, MPI_STATUS_IGNORE );
+    c->pending = 0;
+    c->unorm = c->sum;
+    c->unorm_iteration = c->pending_iteration;
+    converged = c->unorm <= c->residual;
+  }
+
+  if( !converged ){
+    c->local = unorm;
+    MPI_Iallreduce( &c->local, &c->sum, 1, MPI_DOUBLE, MPI_SUM, c->comm, &c->request );
+    c->pending = 1;
+    c->pending_iteration = iteration;
+  }
+  return converged;
+}
+
+
+/* Complete a sum still on its way when the iterations stop for
+   another reason. Its result becomes the last summed change. */
+void convergence_finish( convergence_t *c ){
+  if( c->pending ){
+    MPI_Wait( &c->request, MPI_STATUS_IGNORE );
+    c->pending = 0;
+    c->unorm = c->sum;
+    c->unorm_iteration = c->pending_iteration;
+  }
+}
@@ -0,0 +1,29 @@
+/* Convergence checks of the Poisson solver */
+
+#ifndef POISSON_CONVERGENCE_H
+#define POISSON_CONVERGENCE_H
+
+#include <mpi.h>
+
+/* The change of the field is summed over the ranks only every few
+   iterations, and with async the sum runs in the background until
+   the next check. */
+typedef struct {
+  MPI_Comm comm;
+  double residual;     // Stop when the summed change is below this
+  int every;           // Iterations between two checks
+  int async;           // Use MPI_Iallreduce and take the result at the next check
+  int calls;           // Iterations seen so far
+  int pending;         // A sum is on its way
+  int pending_iteration; // The iteration of the sum on its way
+  double local, sum;   // Buffers of the sum on its way
+  MPI_Request request;
+  double unorm;        // The last summed change
+  int unorm_iteration; // The iteration of unorm, -1 before the first check
+} convergence_t;
+
+void convergence_init( convergence_t *c, MPI_Comm comm, double residual, int every, int async );
+int convergence_check( convergence_t *c, int iteration, double unorm );
+void convergence_finish( convergence_t *c );
+
+#endif
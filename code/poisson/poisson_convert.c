@@ -0,0 +1,63 @@
+/* Convert a field file written by poisson_solver -O to text */
+
+/* Compile with
+     gcc -O2 -o poisson_convert poisson_convert.c
+   and run with
+     ./poisson_convert field.bin field.txt
+   The text has one value per line, in the "%f" format of the other
+   Poisson codes, row after row from j=0 to j=ny+1 and each row from
+   i=0 to i=nx+1. Without an output file the text goes to stdout. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "poisson_file.h"
+
+
+int main(int argc, char** argv) {
+   field_header_t header;
+   FILE *in, *out;
+   float *row;
+   size_t width;
+
+   if( argc < 2 || argc > 3 ){
+      fprintf(stderr, "Usage: %s field.bin [field.txt]\n", argv[0]);
+      return 1;
+   }
+
+   in = fopen(argv[1], "rb");
+   if( in == NULL ){
+      fprintf(stderr, "Could not open %s\n", argv[1]);
+      return 1;
+   }
+   if( fread(&header, sizeof(header), 1, in) != 1
+    || strncmp(header.magic, FIELD_FILE_MAGIC, sizeof(header.magic)) != 0
+    || header.value_size != sizeof(float) ){
+      fprintf(stderr, "%s is not a field file written on this kind of machine\n", argv[1]);
+      return 1;
+   }
+
+   out = argc == 3 ? fopen(argv[2], "w") : stdout;
+   if( out == NULL ){
+      fprintf(stderr, "Could not open %s\n", argv[2]);
+      return 1;
+   }
+
+   // A row at a time, the whole field may not fit in memory
+   width = header.nx + 2;
+   row = malloc( width*sizeof(float) );
+   fseek(in, header.header_size, SEEK_SET);
+   for( int j=0; j <= header.ny+1; j++ ){
+      if( fread(row, sizeof(float), width, in) != width ){
+         fprintf(stderr, "%s ends after %d rows\n", argv[1], j);
+         return 1;
+      }
+      for( size_t i=0; i < width; i++ ) fprintf(out, "%f\n", row[i]);
+   }
+
+   free(row);
+   fclose(in);
+   if( out != stdout ) fclose(out);
+   return 0;
+}
@@ -0,0 +1,135 @@
+/* Domain decomposition of the Poisson solver */
+
+/* Slabs of rows have two neighbours and a halo of two rows of the
+   full width, whatever the number of ranks. Square blocks have four
+   neighbours, but their halo shrinks with the square root of the
+   number of ranks, so there is less to communicate per point. */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "poisson_decomp.h"
+#include "poisson_field.h"
+#include "poisson_halo.h"
+
+
+/* Fill in the neighbours of a block on the Cartesian communicator
+   cart. The block has nx*ny points, starting after the global
+   point j_offset, i_offset. Returns 0 on success. */
+int decomp_init( decomp_t *d, MPI_Comm cart, int nx, int ny, int j_offset, int i_offset ){
+  int periods[2];
+
+  d->comm = cart;
+  MPI_Cart_get( cart, 2, d->dims, periods, d->coords );
+
+  // MPI_Cart_shift returns MPI_PROC_NULL past the edges of the grid
+  MPI_Cart_shift( cart, 0, 1, &d->down, &d->up );
+  MPI_Cart_shift( cart, 1, 1, &d->left, &d->right );
+
+  d->nx = nx;
+  d->ny = ny;
+  d->j_offset = j_offset;
+  d->i_offset = i_offset;
+
+  // The columns are strided, every field of this shape shares the
+  // same type
+  MPI_Type_vector( ny, 1, field_stride(nx, 1), MPI_FLOAT, &d->column );
+  MPI_Type_commit( &d->column );
+
+  d->depth = 1;
+  d->columns = MPI_DATATYPE_NULL;
+  d->rows = MPI_DATATYPE_NULL;
+  d->halo = HALO_DATATYPE;
+  d->buffer = malloc( 4*ny*sizeof(float) );
+  return d->buffer == NULL ? -1 : 0;
+}
+
+
+/* Split n points over parts ranks and return the count and the
+   global offset of the points of rank index. The first n%parts ranks
+   get one extra point, so the counts differ by at most one. */
+void decomp_partition( int n, int parts, int index, int *count, int *offset ){
+  int base = n/parts, extra = n%parts;
+
+  *count = base + (index < extra);
+  *offset = index*base + (index < extra ? index : extra);
+}
+
+
+/* Split a global grid of nx*ny points over the ranks of comm.
+   The entries of dims that are zero are chosen by MPI_Dims_create.
+   Returns 0 on success and -1 if the dims do not match the number
+   of ranks, a rank would get no points or memory runs out. */
+int decomp_create( decomp_t *d, int nx, int ny, const int dims[2], MPI_Comm comm ){
+  int n_ranks, grid[2] = { dims[0], dims[1] }, periods[2] = { 0, 0 };
+  int coords[2], fixed, block_nx, block_ny, i_offset, j_offset;
+  MPI_Comm cart;
+
+  MPI_Comm_size( comm, &n_ranks );
+  fixed = (grid[0] > 0 ? grid[0] : 1)*(grid[1] > 0 ? grid[1] : 1);
+  if( grid[0] < 0 || grid[1] < 0 || n_ranks % fixed != 0 ) return -1;
+  if( grid[0] > 0 && grid[1] > 0 && fixed != n_ranks ) return -1;
+  MPI_Dims_create( n_ranks, 2, grid );
+
+  // Every rank needs at least one row and one column
+  if( ny < grid[0] || nx < grid[1] ) return -1;
+
+  // Let MPI number the ranks to match the network
+  MPI_Cart_create( comm, 2, grid, periods, 1, &cart );
+  MPI_Cart_get( cart, 2, grid, periods, coords );
+
+  // The ranks in a row of the grid share the same rows of points and
+  // the ranks in a column the same columns, so the halos match
+  decomp_partition( ny, grid[0], coords[0], &block_ny, &j_offset );
+  decomp_partition( nx, grid[1], coords[1], &block_nx, &i_offset );
+  return decomp_init( d, cart, block_nx, block_ny, j_offset, i_offset );
+}
+
+
+/* Set up the exchange of fields with depth ghost layers: the types
+   of the blocks of columns and rows, built once for the run, and
+   room in the buffer for packed columns. Returns 0 on success. */
+int decomp_set_depth( decomp_t *d, int depth ){
+  ptrdiff_t stride = field_stride( d->nx, depth );
+  float *buffer;
+
+  if( d->columns != MPI_DATATYPE_NULL ) MPI_Type_free( &d->columns );
+  if( d->rows != MPI_DATATYPE_NULL ) MPI_Type_free( &d->rows );
+  d->depth = depth;
+  if( depth == 1 ) return 0;
+
+  MPI_Type_vector( d->ny, depth, stride, MPI_FLOAT, &d->columns );
+  MPI_Type_vector( depth, d->nx+2*depth, stride, MPI_FLOAT, &d->rows );
+  MPI_Type_commit( &d->columns );
+  MPI_Type_commit( &d->rows );
+
+  buffer = realloc( d->buffer, 4*(size_t)depth*d->ny*sizeof(float) );
+  if( buffer == NULL ) return -1;
+  d->buffer = buffer;
+  return 0;
+}
+
+
+void decomp_free( decomp_t *d ){
+  free( d->buffer );
+  if( d->columns != MPI_DATATYPE_NULL ) MPI_Type_free( &d->columns );
+  if( d->rows != MPI_DATATYPE_NULL ) MPI_Type_free( &d->rows );
+  MPI_Type_free( &d->column );
+  MPI_Comm_free( &d->comm );
+}
+
+
+/* The ranks of the neighbours in the order of the halo windows of
+   poisson_window.c and poisson_rma.c: down, up, left, right */
+void decomp_neighbours( const decomp_t *d, int rank[4] ){
+  rank[0] = d->down;
+  rank[1] = d->up;
+  rank[2] = d->left;
+  rank[3] = d->right;
+}
+
+
+/* The first address of a window aligned for a field */
+float *decomp_align_window( void *base ){
+  return (float *)( ((uintptr_t)base + FIELD_ALIGNMENT - 1) / FIELD_ALIGNMENT * FIELD_ALIGNMENT );
+}
@@ -0,0 +1,35 @@
+/* Domain decomposition of the Poisson solver */
+
+#ifndef POISSON_DECOMP_H
+#define POISSON_DECOMP_H
+
+#include <mpi.h>
+
+/* The grid is split into blocks on a two dimensional Cartesian grid
+   of ranks. Direction 0 is j and direction 1 is i, so a grid of
+   n_ranks x 1 ranks gives the slabs of the other Poisson codes. */
+typedef struct {
+  MPI_Comm comm;          // Cartesian communicator of the ranks
+  int dims[2];            // Number of ranks in the j and i directions
+  int coords[2];          // Position of this rank
+  int down, up;           // Ranks holding the rows j=0 and j=ny+1
+  int left, right;        // Ranks holding the columns i=0 and i=nx+1
+  int nx, ny;             // Number of local interior points
+  int i_offset, j_offset; // Global index of the local point j=0, i=0
+  MPI_Datatype column;    // A column of the interior rows of a field
+  int depth;              // Ghost layers of the fields, see decomp_set_depth
+  MPI_Datatype columns;   // depth columns of the interior rows, if depth > 1
+  MPI_Datatype rows;      // depth rows with their ghost columns, if depth > 1
+  int halo;               // How the halo is exchanged, one of the HALO_ values
+  float *buffer;          // Room for four blocks of depth columns when they are packed
+} decomp_t;
+
+void decomp_partition( int n, int parts, int index, int *count, int *offset );
+int decomp_create( decomp_t *d, int nx, int ny, const int dims[2], MPI_Comm comm );
+int decomp_init( decomp_t *d, MPI_Comm cart, int nx, int ny, int j_offset, int i_offset );
+int decomp_set_depth( decomp_t *d, int depth );
+void decomp_free( decomp_t *d );
+void decomp_neighbours( const decomp_t *d, int rank[4] );
+float *decomp_align_window( void *base );
+
+#endif
@@ -0,0 +1,104 @@
+/* Storage for the fields of the Poisson solver */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "poisson_field.h"
+
+
+/* Round n up to a multiple of the number of floats in a cache line */
+static ptrdiff_t round_to_line( ptrdiff_t n ){
+  return (n + FIELD_ALIGNMENT_FLOATS - 1) / FIELD_ALIGNMENT_FLOATS * FIELD_ALIGNMENT_FLOATS;
+}
+
+
+/* The distance between two rows of a field with nx points per row
+   and halo ghost layers */
+ptrdiff_t field_stride( int nx, int halo ){
+  return round_to_line( round_to_line(halo) + nx + halo );
+}
+
+
+/* The number of bytes of a field with nx*ny interior points and
+   halo ghost layers */
+size_t field_size( int nx, int ny, int halo ){
+  return (size_t)(ny + 2*halo) * field_stride(nx, halo) * sizeof(float);
+}
+
+
+/* Set up f for a field with nx*ny interior points in the memory at
+   data, which must hold field_size bytes and be aligned to
+   FIELD_ALIGNMENT. Each row is padded so that the first interior
+   point, i=1, starts a cache line. */
+void field_wrap( field_t *f, float *data, int nx, int ny, int halo ){
+  ptrdiff_t lead = round_to_line(halo);
+
+  f->nx = nx;
+  f->ny = ny;
+  f->halo = halo;
+  f->stride = field_stride(nx, halo);
+  f->data = data;
+
+  // Row j=1-halo starts at data and the point i=1 is at lead
+  f->origin = f->data + (halo-1)*f->stride + (lead-1);
+}
+
+
+/* Reserve memory for a field with nx*ny interior points.
+   Returns 0 on success. */
+int field_alloc( field_t *f, int nx, int ny, int halo ){
+  float *data;
+
+  if( nx < 1 || ny < 1 || halo < 1 ) return -1;
+
+  if( posix_memalign( (void **) &data, FIELD_ALIGNMENT, field_size(nx, ny, halo) ) != 0 ){
+    f->data = NULL;
+    return -1;
+  }
+  field_wrap( f, data, nx, ny, halo );
+  return 0;
+}
+
+
+void field_free( field_t *f ){
+  free(f->data);
+  f->data = NULL;
+  f->origin = NULL;
+}
+
+
+/* Set every point, including the ghost layers. The rows are
+   shared between the threads like in the sweeps, so that the pages
+   of a new field are first touched by the thread using them and
+   end up in the memory close to it. */
+void field_fill( field_t *f, float value ){
+  #pragma omp parallel for schedule(static)
+  for( int j = 1-f->halo; j <= f->ny+f->halo; j++ ){
+    float *row = FIELD_ROW(f, j);
+    for( int i = 1-f->halo; i <= f->nx+f->halo; i++ ){
+      row[i] = value;
+    }
+  }
+}
+
+
+/* Copy a field, including the ghost layers. The fields must
+   have the same shape. Like field_fill, each thread copies its own
+   rows. */
+void field_copy( field_t *dst, const field_t *src ){
+  int rows = src->ny + 2*src->halo;
+
+  #pragma omp parallel for schedule(static)
+  for( int r = 0; r < rows; r++ ){
+    memcpy( dst->data + r*src->stride, src->data + r*src->stride, src->stride*sizeof(float) );
+  }
+}
+
+
+/* Exchange the storage of two fields of the same shape.
+   The solvers use this instead of copying the new field back */
+void field_swap( field_t *a, field_t *b ){
+  field_t tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
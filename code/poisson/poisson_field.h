@@ -0,0 +1,38 @@
+/* Storage for the fields of the Poisson solver */
+
+#ifndef POISSON_FIELD_H
+#define POISSON_FIELD_H
+
+#include <stddef.h>
+
+/* Rows start on a cache line boundary */
+#define FIELD_ALIGNMENT 64
+#define FIELD_ALIGNMENT_FLOATS (FIELD_ALIGNMENT/sizeof(float))
+
+/* A field on the local part of the grid, stored in a single
+   block of memory with ghost rows and ghost columns.
+   The interior points are j=1..ny and i=1..nx, following the
+   convention of the other Poisson codes. The ghost layers extend
+   from 1-halo to 0 and from n+1 to n+halo. */
+typedef struct {
+  int nx, ny;        // Number of interior points in the i and j directions
+  int halo;          // Number of ghost layers on each side
+  ptrdiff_t stride;  // Distance between the start of two rows, in floats
+  float *data;       // The allocated block
+  float *origin;     // Address of the point j=0, i=0
+} field_t;
+
+/* Address of row j and of the point (j,i) */
+#define FIELD_ROW(f, j) ((f)->origin + (ptrdiff_t)(j)*(f)->stride)
+#define FIELD(f, j, i) (FIELD_ROW(f, j)[i])
+
+ptrdiff_t field_stride( int nx, int halo );
+size_t field_size( int nx, int ny, int halo );
+void field_wrap( field_t *f, float *data, int nx, int ny, int halo );
+int field_alloc( field_t *f, int nx, int ny, int halo );
+void field_free( field_t *f );
+void field_fill( field_t *f, float value );
+void field_copy( field_t *dst, const field_t *src );
+void field_swap( field_t *a, field_t *b );
+
+#endif
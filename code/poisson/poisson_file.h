@@ -0,0 +1,24 @@
+/* The layout of the field files of the Poisson solver */
+
+#ifndef POISSON_FILE_H
+#define POISSON_FILE_H
+
+#include <stdint.h>
+
+#define FIELD_FILE_MAGIC "POISSON"
+
+/* A field file starts with this header, followed by the values of
+   the whole grid including the boundary, as floats in the byte order
+   of the machine that wrote it. The rows j=0..ny+1 follow each
+   other and each holds the points i=0..nx+1. */
+typedef struct {
+  char magic[8];         // FIELD_FILE_MAGIC
+  int32_t header_size;   // Offset of the first value in bytes
+  int32_t value_size;    // Bytes per value, sizeof(float)
+  int32_t nx, ny;        // Interior points in the i and j directions
+  int32_t iterations;    // Iterations run to reach the field
+  float h;               // Lattice spacing
+  int32_t reserved[2];
+} field_header_t;
+
+#endif
@@ -0,0 +1,285 @@
+/* Halo exchange for the Poisson solver */
+
+#include <string.h>
+#include <mpi.h>
+
+#include "poisson_halo.h"
+
+
+/* Find the halo exchange matching a command line name, -1 if none does */
+int halo_from_name( const char *name ){
+  if( strcmp(name, "datatype") == 0 ) return HALO_DATATYPE;
+  if( strcmp(name, "pack") == 0 ) return HALO_PACK;
+  if( strcmp(name, "shared") == 0 ) return HALO_SHARED;
+  if( strcmp(name, "rma") == 0 ) return HALO_RMA;
+  return -1;
+}
+
+
+const char *halo_name( int halo ){
+  if( halo == HALO_PACK ) return "pack";
+  if( halo == HALO_SHARED ) return "shared";
+  if( halo == HALO_RMA ) return "rma";
+  return "datatype";
+}
+
+
+/* Copy the first and the last u->halo columns of u into the first
+   two blocks of the buffer of d */
+static void pack_columns( const field_t *u, const decomp_t *d ){
+  int k = u->halo;
+  float *first = d->buffer, *last = d->buffer + k*u->ny;
+
+  for( int j=1; j <= u->ny; j++ ){
+    for( int c=0; c < k; c++ ){
+      first[(j-1)*k + c] = FIELD(u, j, 1+c);
+      last[(j-1)*k + c] = FIELD(u, j, u->nx-k+1+c);
+    }
+  }
+}
+
+
+/* Copy the last two blocks of the buffer of d into the ghost
+   columns of u. The ghost columns at the edges of the grid keep the
+   boundary values. */
+static void unpack_columns( field_t *u, const decomp_t *d ){
+  int k = u->halo;
+  const float *left = d->buffer + 2*k*u->ny, *right = d->buffer + 3*k*u->ny;
+
+  if( d->left != MPI_PROC_NULL )
+    for( int j=1; j <= u->ny; j++ )
+      for( int c=0; c < k; c++ ) FIELD(u, j, 1-k+c) = left[(j-1)*k + c];
+  if( d->right != MPI_PROC_NULL )
+    for( int j=1; j <= u->ny; j++ )
+      for( int c=0; c < k; c++ ) FIELD(u, j, u->nx+1+c) = right[(j-1)*k + c];
+}
+
+
+/* The halo exchange of halo_exchange for a field with more than one
+   ghost layer. The blocks of columns and rows are described by the
+   types of d, built by decomp_set_depth for the depth of the halo.
+   With HALO_PACK the columns go through the buffer of d. */
+static void exchange_deep( field_t *u, const decomp_t *d ){
+  int nx = u->nx, ny = u->ny, k = u->halo;
+
+  if( d->halo == HALO_PACK ){
+    float *buffer = d->buffer;
+
+    pack_columns( u, d );
+    MPI_Sendrecv( buffer, k*ny, MPI_FLOAT, d->left, 1,
+                  buffer + 3*k*ny, k*ny, MPI_FLOAT, d->right, 1, d->comm, MPI_STATUS_IGNORE );
+    MPI_Sendrecv( buffer + k*ny, k*ny, MPI_FLOAT, d->right, 2,
+                  buffer + 2*k*ny, k*ny, MPI_FLOAT, d->left, 2, d->comm, MPI_STATUS_IGNORE );
+    unpack_columns( u, d );
+  } else {
+    MPI_Sendrecv( &FIELD(u,1,1), 1, d->columns, d->left, 1,
+                  &FIELD(u,1,nx+1), 1, d->columns, d->right, 1, d->comm, MPI_STATUS_IGNORE );
+    MPI_Sendrecv( &FIELD(u,1,nx-k+1), 1, d->columns, d->right, 2,
+                  &FIELD(u,1,1-k), 1, d->columns, d->left, 2, d->comm, MPI_STATUS_IGNORE );
+  }
+  MPI_Sendrecv( &FIELD(u,1,1-k), 1, d->rows, d->down, 3,
+                &FIELD(u,ny+1,1-k), 1, d->rows, d->up, 3, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &FIELD(u,ny-k+1,1-k), 1, d->rows, d->up, 4,
+                &FIELD(u,1-k,1-k), 1, d->rows, d->down, 4, d->comm, MPI_STATUS_IGNORE );
+}
+
+
+/* Fill the ghost layer of u from the four neighbouring blocks.
+   The columns are exchanged first and the rows after them. The rows
+   include the ghost columns, so the corners arrive from the
+   diagonal neighbours through the neighbours in between.
+   The rows are contiguous in the field and are sent without
+   copying. The columns are described by the strided type of the
+   decomposition, or with HALO_PACK copied through the buffer of d.
+   With HALO_SHARED and HALO_RMA this sends messages like
+   HALO_DATATYPE, the fields in windows use halo_window_exchange and
+   halo_rma_exchange instead.
+   At the edges of the grid the neighbour is MPI_PROC_NULL and the
+   ghost points keep the boundary values. Fields with several ghost
+   layers get all of them, the depth of d must have been set to
+   their halo with decomp_set_depth and the blocks must be at least
+   as wide as the halo. */
+void halo_exchange( field_t *u, const decomp_t *d ){
+  int nx = u->nx, ny = u->ny;
+
+  if( u->halo > 1 ){
+    exchange_deep( u, d );
+    return;
+  }
+
+  if( d->halo == HALO_PACK ){
+    float *buffer = d->buffer;
+
+    pack_columns( u, d );
+    MPI_Sendrecv( buffer, ny, MPI_FLOAT, d->left, 1,
+                  buffer + 3*ny, ny, MPI_FLOAT, d->right, 1, d->comm, MPI_STATUS_IGNORE );
+    MPI_Sendrecv( buffer + ny, ny, MPI_FLOAT, d->right, 2,
+                  buffer + 2*ny, ny, MPI_FLOAT, d->left, 2, d->comm, MPI_STATUS_IGNORE );
+    unpack_columns( u, d );
+  } else {
+    // Send the first column left and receive the column right of the last one
+    MPI_Sendrecv( &FIELD(u,1,1), 1, d->column, d->left, 1,
+                  &FIELD(u,1,nx+1), 1, d->column, d->right, 1, d->comm, MPI_STATUS_IGNORE );
+    // Send the last column right and receive the column left of the first one
+    MPI_Sendrecv( &FIELD(u,1,nx), 1, d->column, d->right, 2,
+                  &FIELD(u,1,0), 1, d->column, d->left, 2, d->comm, MPI_STATUS_IGNORE );
+  }
+
+  // The same for the rows, with the ghost columns
+  MPI_Sendrecv( &FIELD(u,1,0), nx+2, MPI_FLOAT, d->down, 3,
+                &FIELD(u,ny+1,0), nx+2, MPI_FLOAT, d->up, 3, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &FIELD(u,ny,0), nx+2, MPI_FLOAT, d->up, 4,
+                &FIELD(u,0,0), nx+2, MPI_FLOAT, d->down, 4, d->comm, MPI_STATUS_IGNORE );
+}
+
+
+/* The functions posting the receives and the sends, MPI_Irecv and
+   MPI_Isend or MPI_Recv_init and MPI_Send_init */
+typedef int (*recv_function)( void *, int, MPI_Datatype, int, int, MPI_Comm, MPI_Request * );
+typedef int (*send_function)( const void *, int, MPI_Datatype, int, int, MPI_Comm, MPI_Request * );
+
+/* Post the receives into the ghost layer of u and the sends of the
+   boundary rows and columns, without the corners. With HALO_PACK
+   the columns go through the buffer of d. */
+static void post( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS],
+                  recv_function recv, send_function send ){
+  int nx = u->nx, ny = u->ny;
+
+  // Tags 1 and 2 for columns moving left and right, 3 and 4 for
+  // rows moving down and up
+  if( d->halo == HALO_PACK ){
+    recv( d->buffer + 3*ny, ny, MPI_FLOAT, d->right, 1, d->comm, &requests[0] );
+    recv( d->buffer + 2*ny, ny, MPI_FLOAT, d->left, 2, d->comm, &requests[1] );
+  } else {
+    recv( &FIELD(u,1,nx+1), 1, d->column, d->right, 1, d->comm, &requests[0] );
+    recv( &FIELD(u,1,0), 1, d->column, d->left, 2, d->comm, &requests[1] );
+  }
+  recv( &FIELD(u,ny+1,1), nx, MPI_FLOAT, d->up, 3, d->comm, &requests[2] );
+  recv( &FIELD(u,0,1), nx, MPI_FLOAT, d->down, 4, d->comm, &requests[3] );
+  if( d->halo == HALO_PACK ){
+    send( d->buffer, ny, MPI_FLOAT, d->left, 1, d->comm, &requests[4] );
+    send( d->buffer + ny, ny, MPI_FLOAT, d->right, 2, d->comm, &requests[5] );
+  } else {
+    send( &FIELD(u,1,1), 1, d->column, d->left, 1, d->comm, &requests[4] );
+    send( &FIELD(u,1,nx), 1, d->column, d->right, 2, d->comm, &requests[5] );
+  }
+  send( &FIELD(u,1,1), nx, MPI_FLOAT, d->down, 3, d->comm, &requests[6] );
+  send( &FIELD(u,ny,1), nx, MPI_FLOAT, d->up, 4, d->comm, &requests[7] );
+}
+
+
+/* The requests of a field with several ghost layers, as in
+   exchange_deep. The columns come first in requests[0..3] and the
+   rows, which carry the corners, in requests[4..7]. */
+static void post_deep( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS],
+                       recv_function recv, send_function send ){
+  int nx = u->nx, ny = u->ny, k = u->halo;
+
+  if( d->halo == HALO_PACK ){
+    recv( d->buffer + 3*k*ny, k*ny, MPI_FLOAT, d->right, 1, d->comm, &requests[0] );
+    recv( d->buffer + 2*k*ny, k*ny, MPI_FLOAT, d->left, 2, d->comm, &requests[1] );
+    send( d->buffer, k*ny, MPI_FLOAT, d->left, 1, d->comm, &requests[2] );
+    send( d->buffer + k*ny, k*ny, MPI_FLOAT, d->right, 2, d->comm, &requests[3] );
+  } else {
+    recv( &FIELD(u,1,nx+1), 1, d->columns, d->right, 1, d->comm, &requests[0] );
+    recv( &FIELD(u,1,1-k), 1, d->columns, d->left, 2, d->comm, &requests[1] );
+    send( &FIELD(u,1,1), 1, d->columns, d->left, 1, d->comm, &requests[2] );
+    send( &FIELD(u,1,nx-k+1), 1, d->columns, d->right, 2, d->comm, &requests[3] );
+  }
+  recv( &FIELD(u,ny+1,1-k), 1, d->rows, d->up, 3, d->comm, &requests[4] );
+  recv( &FIELD(u,1-k,1-k), 1, d->rows, d->down, 4, d->comm, &requests[5] );
+  send( &FIELD(u,1,1-k), 1, d->rows, d->down, 3, d->comm, &requests[6] );
+  send( &FIELD(u,ny-k+1,1-k), 1, d->rows, d->up, 4, d->comm, &requests[7] );
+}
+
+
+/* Start a non-blocking halo exchange: post the receives into the
+   ghost layer and the sends of the boundary rows and columns. The
+   corners are not exchanged. The interior can be updated until
+   halo_end is called, but the ghost points must not be read and
+   the boundary points not written. With HALO_PACK only one exchange
+   per decomposition can be in flight, since they share the buffer. */
+void halo_begin( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS] ){
+  if( d->halo == HALO_PACK ) pack_columns( u, d );
+  post( u, d, requests, MPI_Irecv, MPI_Isend );
+}
+
+
+/* Wait for the exchange started by halo_begin to complete */
+void halo_end( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS] ){
+  MPI_Waitall( HALO_REQUESTS, requests, MPI_STATUSES_IGNORE );
+  if( d->halo == HALO_PACK ) unpack_columns( u, d );
+}
+
+
+/* Persistent requests are set up once for each field and started in
+   every iteration. The library can match the messages and register
+   the memory once instead of in every exchange. */
+
+void halo_plan_init( halo_plan_t *plan ){
+  plan->n_fields = 0;
+}
+
+
+/* Set up the requests for the halo of u, sending the columns as
+   set in d at this point. A field with several ghost layers uses
+   the types of decomp_set_depth. Returns 0 on success and -1 if the
+   plan is full. */
+int halo_plan_add( halo_plan_t *plan, field_t *u, const decomp_t *d ){
+  if( plan->n_fields == HALO_PLAN_FIELDS ) return -1;
+  plan->data[plan->n_fields] = u->data;
+  if( u->halo > 1 )
+    post_deep( u, d, plan->requests[plan->n_fields], MPI_Recv_init, MPI_Send_init );
+  else
+    post( u, d, plan->requests[plan->n_fields], MPI_Recv_init, MPI_Send_init );
+  plan->n_fields++;
+  return 0;
+}
+
+
+/* The requests of u, which must have been added to the plan */
+static MPI_Request *plan_requests( halo_plan_t *plan, const field_t *u ){
+  for( int f=0; f < plan->n_fields; f++ )
+    if( plan->data[f] == u->data ) return plan->requests[f];
+  return NULL;
+}
+
+
+/* Start the requests of u, like halo_begin. The rows of a field
+   with several ghost layers carry the corners, which arrive with
+   the columns, so its columns are complete when this returns and
+   only the rows are still on their way. */
+void halo_plan_begin( halo_plan_t *plan, field_t *u, const decomp_t *d ){
+  MPI_Request *requests = plan_requests( plan, u );
+
+  if( d->halo == HALO_PACK ) pack_columns( u, d );
+  if( u->halo > 1 ){
+    MPI_Startall( 4, requests );
+    MPI_Waitall( 4, requests, MPI_STATUSES_IGNORE );
+    if( d->halo == HALO_PACK ) unpack_columns( u, d );
+    MPI_Startall( 4, requests + 4 );
+    return;
+  }
+  MPI_Startall( HALO_REQUESTS, requests );
+}
+
+
+/* Wait for the requests of u, like halo_end */
+void halo_plan_end( halo_plan_t *plan, field_t *u, const decomp_t *d ){
+  MPI_Request *requests = plan_requests( plan, u );
+
+  if( u->halo > 1 ){
+    MPI_Waitall( 4, requests + 4, MPI_STATUSES_IGNORE );
+    return;
+  }
+  MPI_Waitall( HALO_REQUESTS, requests, MPI_STATUSES_IGNORE );
+  if( d->halo == HALO_PACK ) unpack_columns( u, d );
+}
+
+
+void halo_plan_free( halo_plan_t *plan ){
+  for( int f=0; f < plan->n_fields; f++ )
+    for( int r=0; r < HALO_REQUESTS; r++ )
+      MPI_Request_free( &plan->requests[f][r] );
+  plan->n_fields = 0;
+}
@@ -0,0 +1,43 @@
+/* Halo exchange for the Poisson solver */
+
+#ifndef POISSON_HALO_H
+#define POISSON_HALO_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+/* The number of requests of a non-blocking exchange */
+#define HALO_REQUESTS 8
+
+/* Ways of sending the columns of the halo */
+enum {
+  HALO_DATATYPE,     // Straight from the field with a strided datatype
+  HALO_PACK,         // Copied to and from contiguous buffers
+  HALO_SHARED,       // Read from the neighbours on the node, see poisson_window.h
+  HALO_RMA           // Put into the neighbours, see poisson_rma.h
+};
+
+/* Persistent requests for the fields taking turns in an iteration,
+   for example u and unew of the Jacobi method. The fields are found
+   by their memory, so they may be swapped with field_swap. */
+#define HALO_PLAN_FIELDS 2
+typedef struct {
+  int n_fields;
+  const float *data[HALO_PLAN_FIELDS];
+  MPI_Request requests[HALO_PLAN_FIELDS][HALO_REQUESTS];
+} halo_plan_t;
+
+int halo_from_name( const char *name );
+const char *halo_name( int halo );
+void halo_exchange( field_t *u, const decomp_t *d );
+void halo_begin( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS] );
+void halo_end( field_t *u, const decomp_t *d, MPI_Request requests[HALO_REQUESTS] );
+void halo_plan_init( halo_plan_t *plan );
+int halo_plan_add( halo_plan_t *plan, field_t *u, const decomp_t *d );
+void halo_plan_begin( halo_plan_t *plan, field_t *u, const decomp_t *d );
+void halo_plan_end( halo_plan_t *plan, field_t *u, const decomp_t *d );
+void halo_plan_free( halo_plan_t *plan );
+
+#endif
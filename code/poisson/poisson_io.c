@@ -0,0 +1,206 @@
+/* Binary output and checkpoints of the fields of the Poisson solver */
+
+/* All ranks write their blocks into a single file with one
+   collective call. A subarray type places the block in the global
+   grid and another one picks it out of the field, so the library
+   can combine the blocks into large contiguous writes without any
+   copies in the solver. The file does not depend on the number of
+   ranks, so a checkpoint can be read back onto a different grid of
+   ranks. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "poisson_io.h"
+
+
+/* The types of the block of u in a file holding a global grid of
+   nx*ny interior points and its boundary. The ranks at the edges of
+   the grid also cover their ghost points, which hold the boundary. */
+static void block_types( const field_t *u, const decomp_t *d, int nx, int ny,
+                         MPI_Datatype *file_type, MPI_Datatype *memory_type ){
+  int j_first, j_last, i_first, i_last;
+  int global_sizes[2], local_sizes[2], sizes[2], file_starts[2], starts[2];
+
+  j_first = d->down == MPI_PROC_NULL ? 0 : 1;
+  j_last = d->up == MPI_PROC_NULL ? u->ny+1 : u->ny;
+  i_first = d->left == MPI_PROC_NULL ? 0 : 1;
+  i_last = d->right == MPI_PROC_NULL ? u->nx+1 : u->nx;
+  local_sizes[0] = j_last - j_first + 1;
+  local_sizes[1] = i_last - i_first + 1;
+
+  global_sizes[0] = ny+2;
+  global_sizes[1] = nx+2;
+  file_starts[0] = d->j_offset + j_first;
+  file_starts[1] = d->i_offset + i_first;
+  MPI_Type_create_subarray( 2, global_sizes, local_sizes, file_starts, MPI_ORDER_C,
+                            MPI_FLOAT, file_type );
+  MPI_Type_commit( file_type );
+
+  // The rows of the field are padded to the stride, starting from
+  // the point j=0, i=0
+  sizes[0] = u->ny+2;
+  sizes[1] = u->stride;
+  starts[0] = j_first;
+  starts[1] = i_first;
+  MPI_Type_create_subarray( 2, sizes, local_sizes, starts, MPI_ORDER_C,
+                            MPI_FLOAT, memory_type );
+  MPI_Type_commit( memory_type );
+}
+
+
+/* Open filename for writing and let rank 0 write the header.
+   Returns the error code of MPI_File_open. */
+static int open_for_writing( MPI_File *file, const char *filename, const decomp_t *d,
+                             int nx, int ny, float h, int iterations ){
+  field_header_t header;
+  int rank, error;
+
+  MPI_Comm_rank( d->comm, &rank );
+  error = MPI_File_open( d->comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                         MPI_INFO_NULL, file );
+  if( error != MPI_SUCCESS ) return error;
+  MPI_File_set_size( *file, 0 );
+
+  if( rank == 0 ){
+    memset( &header, 0, sizeof(header) );
+    strcpy( header.magic, FIELD_FILE_MAGIC );
+    header.header_size = sizeof(header);
+    header.value_size = sizeof(float);
+    header.nx = nx;
+    header.ny = ny;
+    header.iterations = iterations;
+    header.h = h;
+    MPI_File_write_at( *file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE );
+  }
+  return MPI_SUCCESS;
+}
+
+
+/* Write u, whose blocks cover a global grid of nx*ny interior points,
+   to filename, with the boundary. All ranks of d must call this
+   together. Returns 0 on success and -1 if the file could not be
+   written. */
+int field_write( const char *filename, const field_t *u, const decomp_t *d,
+                 int nx, int ny, float h, int iterations ){
+  MPI_Datatype file_type, memory_type;
+  MPI_File file;
+  int error;
+
+  if( open_for_writing( &file, filename, d, nx, ny, h, iterations ) != MPI_SUCCESS ) return -1;
+  block_types( u, d, nx, ny, &file_type, &memory_type );
+  MPI_File_set_view( file, sizeof(field_header_t), MPI_FLOAT, file_type, "native", MPI_INFO_NULL );
+  error = MPI_File_write_at_all( file, 0, u->origin, 1, memory_type, MPI_STATUS_IGNORE );
+
+  MPI_Type_free( &file_type );
+  MPI_Type_free( &memory_type );
+  MPI_File_close( &file );
+  return error == MPI_SUCCESS ? 0 : -1;
+}
+
+
+/* Read the block of u from a file written by field_write for a
+   global grid of nx*ny interior points. The ghost points at the
+   edges of the grid get the boundary of the file, the others are
+   left alone. All ranks of d must call this together. The iterations
+   of the header are returned in iterations. Returns 0 on success, -1
+   if the file could not be read or is for a different grid and -2 if
+   it was computed with a lattice spacing other than h. */
+int field_read( const char *filename, field_t *u, const decomp_t *d,
+                int nx, int ny, float h, int *iterations ){
+  MPI_Datatype file_type, memory_type;
+  field_header_t header;
+  MPI_File file;
+  int error;
+
+  if( MPI_File_open( d->comm, filename, MPI_MODE_RDONLY, MPI_INFO_NULL, &file ) != MPI_SUCCESS )
+    return -1;
+
+  error = MPI_File_read_at_all( file, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE );
+  if( error != MPI_SUCCESS
+   || strncmp( header.magic, FIELD_FILE_MAGIC, sizeof(header.magic) ) != 0
+   || header.value_size != sizeof(float) || header.nx != nx || header.ny != ny ){
+    MPI_File_close( &file );
+    return -1;
+  }
+  if( header.h != h ){
+    MPI_File_close( &file );
+    return -2;
+  }
+  *iterations = header.iterations;
+
+  block_types( u, d, nx, ny, &file_type, &memory_type );
+  MPI_File_set_view( file, header.header_size, MPI_FLOAT, file_type, "native", MPI_INFO_NULL );
+  error = MPI_File_read_at_all( file, 0, u->origin, 1, memory_type, MPI_STATUS_IGNORE );
+
+  MPI_Type_free( &file_type );
+  MPI_Type_free( &memory_type );
+  MPI_File_close( &file );
+  return error == MPI_SUCCESS ? 0 : -1;
+}
+
+
+/* Checkpoints are written in the background. The field is copied,
+   since the iterations go on changing it, and the copy written with
+   a non-blocking collective write. The checkpoint goes to a
+   temporary file that replaces the previous checkpoint only once it
+   is complete, so a run killed while writing still has the last
+   one. */
+
+/* Keep checkpoints of fields like u of a global grid of nx*ny
+   interior points with spacing h in filename. Returns 0 on
+   success. */
+int checkpoint_init( checkpoint_t *c, const char *filename, const field_t *u,
+                     int nx, int ny, float h ){
+  c->nx = nx;
+  c->ny = ny;
+  c->h = h;
+  c->pending = 0;
+  snprintf( c->filename, sizeof(c->filename), "%s", filename );
+  snprintf( c->partial, sizeof(c->partial), "%s.partial", filename );
+  return field_alloc( &c->copy, u->nx, u->ny, u->halo );
+}
+
+
+/* Finish the checkpoint on its way, if there is one */
+void checkpoint_wait( checkpoint_t *c, const decomp_t *d ){
+  int rank;
+
+  if( !c->pending ) return;
+  MPI_Wait( &c->request, MPI_STATUS_IGNORE );
+  MPI_Type_free( &c->file_type );
+  MPI_Type_free( &c->memory_type );
+  MPI_File_close( &c->file );
+
+  // Every rank has closed the file before it is renamed
+  MPI_Comm_rank( d->comm, &rank );
+  MPI_Barrier( d->comm );
+  if( rank == 0 && rename( c->partial, c->filename ) != 0 )
+    fprintf(stderr, "Could not rename %s to %s\n", c->partial, c->filename);
+  c->pending = 0;
+}
+
+
+/* Start writing u after the given number of iterations, after
+   finishing the previous checkpoint. All ranks of d must call this
+   together. Returns 0 on success and -1 if the file could not be
+   opened. */
+int checkpoint_save( checkpoint_t *c, const field_t *u, const decomp_t *d, int iterations ){
+  checkpoint_wait( c, d );
+  field_copy( &c->copy, u );
+
+  if( open_for_writing( &c->file, c->partial, d, c->nx, c->ny, c->h, iterations ) != MPI_SUCCESS )
+    return -1;
+  block_types( &c->copy, d, c->nx, c->ny, &c->file_type, &c->memory_type );
+  MPI_File_set_view( c->file, sizeof(field_header_t), MPI_FLOAT, c->file_type, "native", MPI_INFO_NULL );
+  MPI_File_iwrite_at_all( c->file, 0, c->copy.origin, 1, c->memory_type, &c->request );
+  c->pending = 1;
+  return 0;
+}
+
+
+/* Finish the last checkpoint and free the copy */
+void checkpoint_free( checkpoint_t *c, const decomp_t *d ){
+  checkpoint_wait( c, d );
+  field_free( &c->copy );
+}
@@ -0,0 +1,36 @@
+/* Binary output and checkpoints of the fields of the Poisson solver */
+
+#ifndef POISSON_IO_H
+#define POISSON_IO_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+#include "poisson_file.h"
+
+/* A checkpoint of a field in a field file, written in the
+   background while the iterations go on */
+typedef struct {
+  char filename[256];    // The last complete checkpoint
+  char partial[256];     // The one being written
+  int nx, ny;            // Interior points of the global grid
+  float h;               // Lattice spacing
+  field_t copy;          // The field as it was when the write started
+  int pending;           // A write is on its way
+  MPI_File file;
+  MPI_Request request;
+  MPI_Datatype file_type, memory_type;
+} checkpoint_t;
+
+int field_write( const char *filename, const field_t *u, const decomp_t *d,
+                 int nx, int ny, float h, int iterations );
+int field_read( const char *filename, field_t *u, const decomp_t *d,
+                int nx, int ny, float h, int *iterations );
+int checkpoint_init( checkpoint_t *c, const char *filename, const field_t *u,
+                     int nx, int ny, float h );
+int checkpoint_save( checkpoint_t *c, const field_t *u, const decomp_t *d, int iterations );
+void checkpoint_wait( checkpoint_t *c, const decomp_t *d );
+void checkpoint_free( checkpoint_t *c, const decomp_t *d );
+
+#endif
@@ -0,0 +1,224 @@
+/* Update kernels for the Poisson solver */
+
+#include <string.h>
+#include <math.h>
+
+#include "poisson_kernels.h"
+
+
+/* The row kernel used by the fused sweep */
+static jacobi_row_t jacobi_row = jacobi_row_scalar;
+
+
+/* Choose the instruction set of the fused sweep. Call at startup.
+   Returns the instruction set chosen, or -1 if it is not supported */
+int kernel_select_isa( int isa ){
+  jacobi_row_t kernel = jacobi_row_kernel( &isa );
+  if( kernel == NULL ) return -1;
+  jacobi_row = kernel;
+  return isa;
+}
+
+
+/* Find the kernel matching a command line name, -1 if none does */
+int kernel_from_name( const char *name ){
+  if( strcmp(name, "reference") == 0 ) return KERNEL_REFERENCE;
+  if( strcmp(name, "fused") == 0 ) return KERNEL_FUSED;
+  if( strcmp(name, "tiled") == 0 ) return KERNEL_TILED;
+  return -1;
+}
+
+
+/* The reference kernel, with one pass over the field to update
+   it and a second one to find the change */
+static double sweep_reference( const field_t *u, field_t *unew, const field_t *rho, float hsq ){
+  double unorm;
+
+  // Calculate one timestep
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= u->ny; j++){
+    const float *up = FIELD_ROW(u, j-1);
+    const float *mid = FIELD_ROW(u, j);
+    const float *down = FIELD_ROW(u, j+1);
+    const float *rhorow = FIELD_ROW(rho, j);
+    float *newrow = FIELD_ROW(unew, j);
+    for( int i=1; i <= u->nx; i++){
+      float difference = mid[i-1] + mid[i+1] + up[i] + down[i];
+      newrow[i] = 0.25*( difference - hsq*rhorow[i] );
+    }
+  }
+
+  // Find the difference compared to the previous time step
+  unorm = 0.0;
+  #pragma omp parallel for schedule(static) reduction(+:unorm)
+  for( int j = 1;j <= u->ny; j++){
+    const float *oldrow = FIELD_ROW(u, j);
+    const float *newrow = FIELD_ROW(unew, j);
+    for( int i = 1;i <= u->nx; i++){
+      float diff = newrow[i]-oldrow[i];
+      unorm +=diff*diff;
+    }
+  }
+
+  return unorm;
+}
+
+
+/* The fused kernel on the block of rows j_first..j_last and columns
+   i_first..i_last. The squared change is added to unorm. Points
+   outside the block are not written, so the halo only needs to be
+   in place for the points next to the ghost layer. */
+double jacobi_block( const field_t *u, field_t *unew, const field_t *rho, float hsq,
+                     int j_first, int j_last, int i_first, int i_last, double unorm ){
+  // The row kernel starts from the point after the pointers
+  int shift = i_first-1, n = i_last-i_first+1;
+  if( n < 1 ) return unorm;
+  #pragma omp parallel for schedule(static) reduction(+:unorm)
+  for( int j=j_first; j <= j_last; j++){
+    unorm = jacobi_row( unorm, FIELD_ROW(unew, j)+shift, FIELD_ROW(u, j-1)+shift, FIELD_ROW(u, j)+shift,
+                        FIELD_ROW(u, j+1)+shift, FIELD_ROW(rho, j)+shift, hsq, n );
+  }
+  return unorm;
+}
+
+
+/* The fused kernel, a single pass over the field. Each point is
+   written and compared while it is still in a register, so the
+   field is read and written only once. */
+static double sweep_fused( const field_t *u, field_t *unew, const field_t *rho, float hsq ){
+  return jacobi_block( u, unew, rho, hsq, 1, u->ny, 1, u->nx, 0.0 );
+}
+
+
+/* Run one Jacobi sweep over the interior of the local field with
+   the reference or the fused kernel and return the local sum of
+   the squared change. The new field is
+   written to unew and the two fields are then swapped, so that
+   u holds the result. The ghost layers of u must be up to date. */
+double jacobi_sweep( field_t *u, field_t *unew, const field_t *rho, float hsq, int kernel ){
+  double unorm;
+
+  if( kernel == KERNEL_REFERENCE ){
+    unorm = sweep_reference( u, unew, rho, hsq );
+  } else {
+    unorm = sweep_fused( u, unew, rho, hsq );
+  }
+
+  // Swap instead of copying the new field back into u
+  field_swap( u, unew );
+
+  return unorm;
+}
+
+
+/* Run depth Jacobi sweeps in tiles that stay in the cache.
+   The columns are cut into tiles of tile_width points. Inside a
+   tile the rows are processed as a wavefront: row j of sweep t is
+   updated right after row j+1 of sweep t-1, so only about depth+2
+   rows of the tile are in use at any time. Sweep t reads buffer
+   t%2 and writes the other one, and each sweep of a tile is
+   shifted one column to the left of the previous one, so that the
+   values a tile needs from its left neighbour are already there
+   and the values its right neighbour still needs are not yet
+   overwritten.
+   Each tile needs the values its left neighbour has just written,
+   so the tiles run one after the other on a single thread.
+   ghosts, in the order down, up, left, right of decomp_neighbours,
+   marks the sides where the ghost layers come from another rank, or
+   is NULL if none do. On those sides sweep t also updates
+   depth-1-t ghost layers, so that a halo of depth layers exchanged
+   once is enough for all sweeps, like the deep halo of -G. On the
+   other sides the ghost points hold the boundary.
+   Returns the local squared change of the last sweep and leaves
+   the result in u. The ghost layers of u and unew must contain
+   the boundary values, and with ghosts at least depth layers of u
+   must be filled from the neighbours. */
+double jacobi_sweep_tiled( field_t *u, field_t *unew, const field_t *rho, float hsq,
+                           int tile_width, int depth, const int ghosts[4] ){
+  field_t *buffer[2] = { u, unew };
+  int nx = u->nx, ny = u->ny;
+  int extra[4];
+  double unorm = 0.0;
+
+  // The ghost layers updated by the first sweep on each side
+  for( int k=0; k<4; k++ ) extra[k] = ghosts != NULL && ghosts[k] ? depth-1 : 0;
+
+  for( int a = 1-extra[2]; a <= nx+extra[3]; a += tile_width ){
+    // The last tile covers the columns the others shifted away from
+    int b = a + tile_width > nx+extra[3] ? nx + extra[3] + depth : a + tile_width;
+
+    for( int r = 1-extra[0]; r < ny + extra[1] + depth; r++ ){
+      for( int t = 0; t < depth; t++ ){
+        const field_t *src = buffer[t%2];
+        field_t *dst = buffer[(t+1)%2];
+        int j = r - t;
+        // The region of sweep t shrinks by a layer per sweep on the
+        // sides with ghosts and is the interior in the last sweep
+        int j_first = 1 - (extra[0] ? extra[0]-t : 0);
+        int j_last = ny + (extra[1] ? extra[1]-t : 0);
+        int i_first = 1 - (extra[2] ? extra[2]-t : 0);
+        int i_last = nx + (extra[3] ? extra[3]-t : 0);
+        int first = a - t < i_first ? i_first : a - t;
+        int last = b - t - 1 > i_last ? i_last : b - t - 1;
+        double row_norm;
+
+        if( j < j_first || j > j_last || first > last ) continue;
+
+        // The row kernel updates points 1..n, so start one before first
+        row_norm = jacobi_row( 0.0, FIELD_ROW(dst, j) + first-1,
+                               FIELD_ROW(src, j-1) + first-1, FIELD_ROW(src, j) + first-1,
+                               FIELD_ROW(src, j+1) + first-1, FIELD_ROW(rho, j) + first-1,
+                               hsq, last-first+1 );
+        if( t == depth-1 ) unorm += row_norm;
+      }
+    }
+  }
+
+  // After an odd number of sweeps the result is in unew
+  if( depth%2 == 1 ) field_swap( u, unew );
+
+  return unorm;
+}
+
+
+/* Update the points of one colour in place, with over-relaxation
+   parameter omega. omega=1 gives a Gauss-Seidel update of the
+   colour. Like the checkerboard update of the Ising model, the
+   points are split into even and odd by the parity of i+j, so each
+   point only depends on points of the other colour. offset is the
+   sum of the global indices j and i of the local point j=0, i=0,
+   so that the colours match across ranks. Returns the local
+   squared change. */
+double relax_colour( field_t *u, const field_t *rho, float hsq, float omega,
+                     int parity, int offset ){
+  double unorm = 0.0;
+
+  // The points of one colour do not depend on each other, so the
+  // rows can be shared between threads
+  #pragma omp parallel for schedule(static) reduction(+:unorm)
+  for( int j=1; j <= u->ny; j++){
+    const float *up = FIELD_ROW(u, j-1);
+    const float *down = FIELD_ROW(u, j+1);
+    const float *rhorow = FIELD_ROW(rho, j);
+    float *row = FIELD_ROW(u, j);
+    // The first point of this colour on the row
+    int first = 1 + (j + offset + 1 + parity)%2;
+
+    for( int i=first; i <= u->nx; i+=2 ){
+      float difference = row[i-1] + row[i+1] + up[i] + down[i];
+      float gs = 0.25*( difference - hsq*rhorow[i] );
+      float diff = omega*( gs - row[i] );
+      row[i] += diff;
+      unorm += diff*diff;
+    }
+  }
+
+  return unorm;
+}
+
+
+/* The over-relaxation parameter that minimises the number of
+   iterations for the Laplacian on a square grid */
+float sor_optimal_omega( int gridsize ){
+  return 2.0/( 1.0 + sin( M_PI/(gridsize+1) ) );
+}
@@ -0,0 +1,47 @@
+/* Update kernels for the Poisson solver */
+
+#ifndef POISSON_KERNELS_H
+#define POISSON_KERNELS_H
+
+#include "poisson_field.h"
+
+/* The ways of running a Jacobi sweep */
+enum {
+  KERNEL_REFERENCE,  // Separate passes for the update and the norm
+  KERNEL_FUSED,      // Update and norm in a single pass
+  KERNEL_TILED       // Several fused sweeps per cache sized tile
+};
+
+/* Instruction sets for the row kernels */
+enum {
+  ISA_AUTO = -1,     // The widest one supported by the processor
+  ISA_SCALAR,
+  ISA_SSE2,
+  ISA_AVX2,
+  ISA_AVX512
+};
+
+/* A row kernel updates the points i=1..nx of a row and adds the
+   squared change to unorm */
+typedef double (*jacobi_row_t)( double unorm, float *newrow, const float *up, const float *mid,
+                                const float *down, const float *rhorow, float hsq, int nx );
+
+double jacobi_row_scalar( double unorm, float *newrow, const float *up, const float *mid,
+                          const float *down, const float *rhorow, float hsq, int nx );
+int isa_from_name( const char *name );
+const char *isa_name( int isa );
+int isa_supported( int isa );
+jacobi_row_t jacobi_row_kernel( int *isa );
+
+int kernel_from_name( const char *name );
+int kernel_select_isa( int isa );
+double jacobi_sweep( field_t *u, field_t *unew, const field_t *rho, float hsq, int kernel );
+double jacobi_block( const field_t *u, field_t *unew, const field_t *rho, float hsq,
+                     int j_first, int j_last, int i_first, int i_last, double unorm );
+double jacobi_sweep_tiled( field_t *u, field_t *unew, const field_t *rho, float hsq,
+                           int tile_width, int depth, const int ghosts[4] );
+double relax_colour( field_t *u, const field_t *rho, float hsq, float omega,
+                     int parity, int offset );
+float sor_optimal_omega( int gridsize );
+
+#endif
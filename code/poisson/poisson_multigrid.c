@@ -0,0 +1,393 @@
+/* Geometric multigrid for the Poisson solver */
+
+/* The grid is coarsened by merging 2x2 blocks of points, so the
+   coarse grid has half the points in each direction. A residual is
+   restricted by averaging the four fine points and a correction is
+   interpolated back bilinearly. The smoother is the red-black
+   Gauss-Seidel update of relax_colour.
+   On the finest level the boundary values sit on the ghost points.
+   On a coarse level the ghost points are further out than the
+   boundary, so their values are extrapolated from the points next
+   to them to keep the correction zero on the boundary.
+   Each rank coarsens its own block as long as all blocks have an
+   even number of rows and columns. After that pairs of neighbouring
+   ranks gather their blocks onto one rank, along the direction with
+   the most ranks, until a single rank holds the whole coarsest
+   grid. */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "poisson_multigrid.h"
+#include "poisson_kernels.h"
+#include "poisson_halo.h"
+
+
+/* Allocate the fields of a level with nx*ny points */
+static int level_alloc( mg_level *lev, int nx, int ny ){
+  if( field_alloc( &lev->u, nx, ny, 1 ) != 0
+   || field_alloc( &lev->rhs, nx, ny, 1 ) != 0
+   || field_alloc( &lev->res, nx, ny, 1 ) != 0 ) return -1;
+
+  // The corrections have zero boundaries
+  field_fill( &lev->u, 0.0 );
+  field_fill( &lev->rhs, 0.0 );
+  field_fill( &lev->res, 0.0 );
+  return 0;
+}
+
+
+/* Build the levels for the blocks of the decomposition d. Level 0
+   uses the fields of the solver, so only its residual is allocated
+   here. Returns 0 on success. */
+int multigrid_setup( multigrid_t *mg, const decomp_t *d, float hsq ){
+  int l, coarsening = 1;
+
+  mg->cycles = 0;
+  mg->pre_sweeps = 2;
+  mg->post_sweeps = 2;
+
+  // Level 0 shares the decomposition of the solver
+  mg->level[0].decomp = *d;
+  mg->level[0].hsq = hsq;
+  mg->level[0].mirror = 0;
+  if( field_alloc( &mg->level[0].res, d->nx, d->ny, 1 ) != 0 ) return -1;
+  field_fill( &mg->level[0].res, 0.0 );
+
+  for( l=0; l < MG_MAX_LEVELS-1; l++ ){
+    mg_level *lev = &mg->level[l];
+    mg_level *next = &mg->level[l+1];
+    const decomp_t *ld = &lev->decomp;
+    int nx = ld->nx, ny = ld->ny;
+    int n_ranks, can_coarsen, all_can_coarsen;
+
+    MPI_Comm_size( ld->comm, &n_ranks );
+    lev->pair_comm = MPI_COMM_NULL;
+
+    // The blocks of 2x2 points must not cross the blocks of the ranks
+    can_coarsen = nx%2 == 0 && ny%2 == 0 && nx >= 4 && ny >= 4
+               && ld->j_offset%2 == 0 && ld->i_offset%2 == 0;
+    MPI_Allreduce( &can_coarsen, &all_can_coarsen, 1, MPI_INT, MPI_MIN, ld->comm );
+
+    if( all_can_coarsen ){
+      lev->next = MG_COARSEN;
+      if( decomp_init( &next->decomp, ld->comm, nx/2, ny/2, ld->j_offset/2, ld->i_offset/2 ) != 0 )
+        return -1;
+      next->decomp.halo = ld->halo;
+      next->hsq = 4*lev->hsq;
+      // With k fine points per coarse point, the first coarse point
+      // is (k+1)/2 fine spacings from the boundary and the ghost
+      // point (k-1)/2 on the other side
+      coarsening *= 2;
+      next->mirror = -(coarsening - 1.0)/(coarsening + 1.0);
+      if( level_alloc( next, nx/2, ny/2 ) != 0 ) return -1;
+
+    } else if( n_ranks > 1 ){
+      int dim = ld->dims[0] >= ld->dims[1] ? 0 : 1;
+      int pair_coords[2] = { ld->coords[0], ld->coords[1] };
+      int dims[2] = { ld->dims[0], ld->dims[1] }, periods[2] = { 0, 0 };
+      int rank, pair_rank, n, pair_n;
+      MPI_Comm even, cart;
+
+      // The blocks with coordinates 2k and 2k+1 in the direction dim
+      // form a pair and 2k holds the next level
+      lev->next = MG_GATHER;
+      lev->pair_dim = dim;
+      pair_coords[dim] /= 2;
+      MPI_Comm_rank( ld->comm, &rank );
+      MPI_Comm_split( ld->comm, pair_coords[0]*dims[1] + pair_coords[1], ld->coords[dim]%2,
+                      &lev->pair_comm );
+      MPI_Comm_split( ld->comm, ld->coords[dim]%2 == 0 ? 0 : MPI_UNDEFINED, rank, &even );
+      MPI_Comm_rank( lev->pair_comm, &pair_rank );
+      n = dim == 0 ? ny : nx;
+      MPI_Reduce( &n, &pair_n, 1, MPI_INT, MPI_SUM, 0, lev->pair_comm );
+
+      if( pair_rank != 0 ){
+        // This rank does not take part in the coarser levels
+        break;
+      }
+
+      // The remaining ranks keep their order, so the new grid of
+      // ranks needs no reordering
+      dims[dim] = (dims[dim]+1)/2;
+      MPI_Cart_create( even, 2, dims, periods, 0, &cart );
+      MPI_Comm_free( &even );
+      if( decomp_init( &next->decomp, cart, dim == 1 ? pair_n : nx, dim == 0 ? pair_n : ny,
+                       ld->j_offset, ld->i_offset ) != 0 )
+        return -1;
+      next->decomp.halo = ld->halo;
+      next->hsq = lev->hsq;
+      next->mirror = lev->mirror;
+      if( level_alloc( next, next->decomp.nx, next->decomp.ny ) != 0 ) return -1;
+
+    } else {
+      lev->next = MG_COARSEST;
+      break;
+    }
+  }
+
+  mg->n_levels = l+1;
+  return 0;
+}
+
+
+void multigrid_free( multigrid_t *mg ){
+  field_free( &mg->level[0].res );
+  for( int l=1; l < mg->n_levels; l++ ){
+    field_free( &mg->level[l].u );
+    field_free( &mg->level[l].rhs );
+    field_free( &mg->level[l].res );
+  }
+  for( int l=0; l < mg->n_levels; l++ ){
+    if( mg->level[l].pair_comm != MPI_COMM_NULL )
+      MPI_Comm_free( &mg->level[l].pair_comm );
+    if( l == 0 ) continue;
+    // Level 0 belongs to the solver
+    MPI_Type_free( &mg->level[l].decomp.column );
+    free( mg->level[l].decomp.buffer );
+    if( mg->level[l].decomp.comm != mg->level[l-1].decomp.comm )
+      MPI_Comm_free( &mg->level[l].decomp.comm );
+  }
+}
+
+
+/* Fill the ghost layer of u: exchange the halo and on the coarse
+   levels set the boundary values on the edges of the grid */
+static void update_ghosts( mg_level *lev ){
+  const decomp_t *d = &lev->decomp;
+  field_t *u = &lev->u;
+
+  halo_exchange( u, d );
+  if( lev->mirror == 0 ) return;
+
+  // The rows first, then the columns including the corners
+  if( d->down == MPI_PROC_NULL )
+    for( int i=0; i <= u->nx+1; i++ ) FIELD(u, 0, i) = lev->mirror*FIELD(u, 1, i);
+  if( d->up == MPI_PROC_NULL )
+    for( int i=0; i <= u->nx+1; i++ ) FIELD(u, u->ny+1, i) = lev->mirror*FIELD(u, u->ny, i);
+  if( d->left == MPI_PROC_NULL )
+    for( int j=0; j <= u->ny+1; j++ ) FIELD(u, j, 0) = lev->mirror*FIELD(u, j, 1);
+  if( d->right == MPI_PROC_NULL )
+    for( int j=0; j <= u->ny+1; j++ ) FIELD(u, j, u->nx+1) = lev->mirror*FIELD(u, j, u->nx);
+}
+
+
+/* Red-black Gauss-Seidel sweeps, the ghosts are updated before each
+   colour. Returns the local squared change of the last sweep. */
+static double smooth( mg_level *lev, int sweeps, float omega ){
+  double unorm = 0.0;
+  for( int sweep=0; sweep<sweeps; sweep++ ){
+    unorm = 0.0;
+    for( int parity=0; parity<2; parity++ ){
+      update_ghosts( lev );
+      unorm += relax_colour( &lev->u, &lev->rhs, lev->hsq, omega, parity,
+                             lev->decomp.j_offset + lev->decomp.i_offset );
+    }
+  }
+  return unorm;
+}
+
+
+/* res = rhs - (sum of neighbours - 4u)/hsq */
+static void residual( mg_level *lev ){
+  field_t *u = &lev->u;
+  update_ghosts( lev );
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= u->ny; j++ ){
+    const float *up = FIELD_ROW(u, j-1);
+    const float *mid = FIELD_ROW(u, j);
+    const float *down = FIELD_ROW(u, j+1);
+    const float *rhsrow = FIELD_ROW(&lev->rhs, j);
+    float *resrow = FIELD_ROW(&lev->res, j);
+    for( int i=1; i <= u->nx; i++ ){
+      float laplacian = ( mid[i-1] + mid[i+1] + up[i] + down[i] - 4*mid[i] )/lev->hsq;
+      resrow[i] = rhsrow[i] - laplacian;
+    }
+  }
+}
+
+
+/* Average 2x2 blocks of the fine field into the coarse field */
+static void restrict_to( field_t *coarse, const field_t *fine ){
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= coarse->ny; j++ ){
+    const float *row1 = FIELD_ROW(fine, 2*j-1);
+    const float *row2 = FIELD_ROW(fine, 2*j);
+    float *crow = FIELD_ROW(coarse, j);
+    for( int i=1; i <= coarse->nx; i++ ){
+      crow[i] = 0.25*( row1[2*i-1] + row1[2*i] + row2[2*i-1] + row2[2*i] );
+    }
+  }
+}
+
+
+/* Interpolate the coarse field bilinearly and add it to the fine
+   field. Each fine point is closest to one coarse point and gets
+   the weights 9/16, 3/16, 3/16 and 1/16 from it and the three
+   coarse points around it on the same side. */
+static void prolong_add( field_t *fine, const field_t *coarse ){
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= fine->ny; j++ ){
+    int jc = (j+1)/2;
+    const float *near = FIELD_ROW(coarse, jc);
+    const float *far = FIELD_ROW(coarse, j%2 == 1 ? jc-1 : jc+1);
+    float *frow = FIELD_ROW(fine, j);
+    for( int i=1; i <= fine->nx; i++ ){
+      int ic = (i+1)/2;
+      int io = i%2 == 1 ? ic-1 : ic+1;
+      frow[i] += ( 9*near[ic] + 3*near[io] + 3*far[ic] + far[io] )/16;
+    }
+  }
+}
+
+
+/* Collect the blocks of src on the first rank of the pair. The
+   block of the second rank is stored after that of the first one,
+   in the direction of the pair. */
+static void gather_block( const mg_level *lev, const field_t *src, field_t *dst ){
+  int dj = lev->pair_dim == 0 ? src->ny : 0;
+  int di = lev->pair_dim == 1 ? src->nx : 0;
+  int pair_rank, pair_size;
+  MPI_Datatype block;
+
+  MPI_Comm_rank( lev->pair_comm, &pair_rank );
+  MPI_Comm_size( lev->pair_comm, &pair_size );
+
+  if( pair_rank == 0 ){
+    for( int j=1; j <= src->ny; j++ )
+      for( int i=1; i <= src->nx; i++ )
+        FIELD(dst, j, i) = FIELD(src, j, i);
+    if( pair_size == 2 ){
+      MPI_Type_vector( dst->ny - dj, dst->nx - di, dst->stride, MPI_FLOAT, &block );
+      MPI_Type_commit( &block );
+      MPI_Recv( &FIELD(dst, 1+dj, 1+di), 1, block, 1, 3, lev->pair_comm, MPI_STATUS_IGNORE );
+      MPI_Type_free( &block );
+    }
+  } else {
+    MPI_Type_vector( src->ny, src->nx, src->stride, MPI_FLOAT, &block );
+    MPI_Type_commit( &block );
+    MPI_Send( &FIELD(src, 1, 1), 1, block, 0, 3, lev->pair_comm );
+    MPI_Type_free( &block );
+  }
+}
+
+
+/* The reverse of gather_block, the blocks are added to dst. The
+   second rank receives its block into tmp first. */
+static void scatter_add_block( const mg_level *lev, const field_t *src, field_t *dst, field_t *tmp ){
+  int dj = lev->pair_dim == 0 ? dst->ny : 0;
+  int di = lev->pair_dim == 1 ? dst->nx : 0;
+  int pair_rank, pair_size;
+  MPI_Datatype block;
+
+  MPI_Comm_rank( lev->pair_comm, &pair_rank );
+  MPI_Comm_size( lev->pair_comm, &pair_size );
+
+  if( pair_rank == 0 ){
+    for( int j=1; j <= dst->ny; j++ )
+      for( int i=1; i <= dst->nx; i++ )
+        FIELD(dst, j, i) += FIELD(src, j, i);
+    if( pair_size == 2 ){
+      MPI_Type_vector( src->ny - dj, src->nx - di, src->stride, MPI_FLOAT, &block );
+      MPI_Type_commit( &block );
+      MPI_Send( &FIELD(src, 1+dj, 1+di), 1, block, 1, 4, lev->pair_comm );
+      MPI_Type_free( &block );
+    }
+  } else {
+    MPI_Type_vector( tmp->ny, tmp->nx, tmp->stride, MPI_FLOAT, &block );
+    MPI_Type_commit( &block );
+    MPI_Recv( &FIELD(tmp, 1, 1), 1, block, 0, 4, lev->pair_comm, MPI_STATUS_IGNORE );
+    MPI_Type_free( &block );
+    for( int j=1; j <= dst->ny; j++ )
+      for( int i=1; i <= dst->nx; i++ )
+        FIELD(dst, j, i) += FIELD(tmp, j, i);
+  }
+}
+
+
+/* Solve on the coarsest level, which is on a single rank, with
+   over-relaxation until the change has dropped well below the
+   first one */
+static void solve_coarsest( mg_level *lev ){
+  int n = lev->u.nx > lev->u.ny ? lev->u.nx : lev->u.ny;
+  float omega = sor_optimal_omega( n );
+  double first = smooth( lev, 1, omega );
+
+  for( int iteration=0; iteration < 10*n; iteration++ ){
+    if( smooth( lev, 1, omega ) <= 1e-8*first ) break;
+  }
+}
+
+
+/* Run a V-cycle on level l, starting from the current u. With
+   full set, run a full multigrid cycle instead: the starting point
+   on each level is interpolated from the solution on the next
+   coarser level, and a V-cycle is run on each level on the way up. */
+static void cycle( multigrid_t *mg, int l, int full ){
+  mg_level *lev = &mg->level[l];
+  mg_level *next = &mg->level[l+1];
+  int active_next = l+1 < mg->n_levels;
+
+  if( lev->next == MG_COARSEST ){
+    solve_coarsest( lev );
+    return;
+  }
+
+  if( !full ) smooth( lev, mg->pre_sweeps, 1.0 );
+
+  // Move the residual to the next level
+  residual( lev );
+  if( lev->next == MG_COARSEN ){
+    restrict_to( &next->rhs, &lev->res );
+  } else {
+    gather_block( lev, &lev->res, &next->rhs );
+  }
+
+  // Find the correction
+  if( active_next ){
+    field_fill( &next->u, 0.0 );
+    cycle( mg, l+1, full );
+  }
+
+  // And add it to u
+  if( lev->next == MG_COARSEN ){
+    update_ghosts( next );
+    prolong_add( &lev->u, &next->u );
+  } else {
+    scatter_add_block( lev, &next->u, &lev->u, &lev->res );
+  }
+
+  if( full ){
+    cycle( mg, l, 0 );
+  } else {
+    smooth( lev, mg->post_sweeps, 1.0 );
+  }
+}
+
+
+/* Run one multigrid cycle on the field u, a V-cycle or with full
+   set a full multigrid cycle. uold is used to store the previous
+   field. Returns the local squared change of u, the same measure as
+   for the other methods. */
+double multigrid_cycle( multigrid_t *mg, field_t *u, field_t *uold, const field_t *rho, int full ){
+  double unorm = 0.0;
+
+  // Level 0 works directly on the fields of the solver
+  mg->level[0].u = *u;
+  mg->level[0].rhs = *rho;
+  field_copy( uold, u );
+
+  cycle( mg, 0, full );
+  mg->cycles++;
+
+  #pragma omp parallel for schedule(static) reduction(+:unorm)
+  for( int j=1; j <= u->ny; j++ ){
+    const float *oldrow = FIELD_ROW(uold, j);
+    const float *newrow = FIELD_ROW(u, j);
+    for( int i=1; i <= u->nx; i++ ){
+      float diff = newrow[i]-oldrow[i];
+      unorm += diff*diff;
+    }
+  }
+  return unorm;
+}
@@ -0,0 +1,44 @@
+/* Geometric multigrid for the Poisson solver */
+
+#ifndef POISSON_MULTIGRID_H
+#define POISSON_MULTIGRID_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+#define MG_MAX_LEVELS 32
+
+/* How a level is connected to the next coarser one */
+enum {
+  MG_COARSEN,   // Half the points in each direction on the same ranks
+  MG_GATHER,    // Same points, pairs of blocks merged onto one rank
+  MG_COARSEST   // No coarser level, solved directly
+};
+
+/* One level of the multigrid hierarchy. Level 0 is the grid of
+   the solver. The coarser levels solve for a correction and have
+   zero boundaries. */
+typedef struct {
+  decomp_t decomp;     // The blocks of the ranks holding this level
+  MPI_Comm pair_comm;  // The pair of ranks merged into the next level
+  int pair_dim;        // The direction, 0 or 1, in which they are merged
+  float hsq;           // Squared lattice spacing on this level
+  float mirror;        // Ghost value at the boundary over the value next to it
+  int next;            // MG_COARSEN, MG_GATHER or MG_COARSEST
+  field_t u, rhs, res; // Solution, right hand side and residual
+} mg_level;
+
+typedef struct {
+  int n_levels;        // The number of levels on this rank
+  int cycles;          // The number of cycles run so far
+  int pre_sweeps, post_sweeps;
+  mg_level level[MG_MAX_LEVELS];
+} multigrid_t;
+
+int multigrid_setup( multigrid_t *mg, const decomp_t *d, float hsq );
+double multigrid_cycle( multigrid_t *mg, field_t *u, field_t *uold, const field_t *rho, int full );
+void multigrid_free( multigrid_t *mg );
+
+#endif
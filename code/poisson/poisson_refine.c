@@ -0,0 +1,96 @@
+/* Mixed precision iterative refinement for the Poisson solver */
+
+/* A solve in single precision stops improving once the change of
+   the field drops to the rounding error of a float. The residual
+   of the equation can still be computed in double precision from a
+   solution kept in double precision. Solving for the correction in
+   single precision and adding it in double precision then gains
+   the digits of a float with every step, while the iterations, which
+   make up most of the memory traffic, still run on floats. */
+
+#include <stdlib.h>
+
+#include "poisson_refine.h"
+
+
+/* Keep the field u, including its ghost layer, in double precision.
+   Returns 0 on success. */
+int refine_init( refine_t *r, const field_t *u ){
+  r->nx = u->nx;
+  r->ny = u->ny;
+  r->stride = u->nx + 2;
+  r->u = malloc( (size_t)(u->ny + 2) * r->stride * sizeof(double) );
+  if( r->u == NULL ) return -1;
+
+  for( int j=0; j <= u->ny+1; j++ )
+    for( int i=0; i <= u->nx+1; i++ )
+      REFINE(r, j, i) = FIELD(u, j, i);
+
+  MPI_Type_vector( r->ny, 1, r->stride, MPI_DOUBLE, &r->column );
+  MPI_Type_commit( &r->column );
+  return 0;
+}
+
+
+/* The halo exchange of halo_exchange for the double precision field */
+static void exchange( refine_t *r, const decomp_t *d ){
+  int nx = r->nx, ny = r->ny;
+
+  MPI_Sendrecv( &REFINE(r,1,1), 1, r->column, d->left, 1,
+                &REFINE(r,1,nx+1), 1, r->column, d->right, 1, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &REFINE(r,1,nx), 1, r->column, d->right, 2,
+                &REFINE(r,1,0), 1, r->column, d->left, 2, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &REFINE(r,1,0), nx+2, MPI_DOUBLE, d->down, 3,
+                &REFINE(r,ny+1,0), nx+2, MPI_DOUBLE, d->up, 3, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &REFINE(r,ny,0), nx+2, MPI_DOUBLE, d->up, 4,
+                &REFINE(r,0,0), nx+2, MPI_DOUBLE, d->down, 4, d->comm, MPI_STATUS_IGNORE );
+}
+
+
+/* res = rho - (sum of neighbours - 4u)/hsq, computed in double
+   precision and rounded to float. Returns the sum of the squared
+   residual over the ranks, in double precision. */
+double refine_residual( refine_t *r, const field_t *rho, float hsq, field_t *res, const decomp_t *d ){
+  double norm = 0.0, global_norm;
+
+  exchange( r, d );
+  #pragma omp parallel for schedule(static) reduction(+:norm)
+  for( int j=1; j <= r->ny; j++ ){
+    for( int i=1; i <= r->nx; i++ ){
+      double laplacian = ( REFINE(r,j,i-1) + REFINE(r,j,i+1) + REFINE(r,j-1,i) + REFINE(r,j+1,i)
+                         - 4*REFINE(r,j,i) )/hsq;
+      double residual = FIELD(rho, j, i) - laplacian;
+      FIELD(res, j, i) = residual;
+      norm += residual*residual;
+    }
+  }
+
+  MPI_Allreduce( &norm, &global_norm, 1, MPI_DOUBLE, MPI_SUM, d->comm );
+  return global_norm;
+}
+
+
+/* Add the correction e to the interior points. The boundary is
+   already in place. */
+void refine_correct( refine_t *r, const field_t *e ){
+  #pragma omp parallel for schedule(static)
+  for( int j=1; j <= r->ny; j++ )
+    for( int i=1; i <= r->nx; i++ )
+      REFINE(r, j, i) += FIELD(e, j, i);
+}
+
+
+/* Round the solution to float into u, including the ghost layer */
+void refine_store( const refine_t *r, field_t *u ){
+  #pragma omp parallel for schedule(static)
+  for( int j=0; j <= r->ny+1; j++ )
+    for( int i=0; i <= r->nx+1; i++ )
+      FIELD(u, j, i) = REFINE(r, j, i);
+}
+
+
+void refine_free( refine_t *r ){
+  free( r->u );
+  r->u = NULL;
+  MPI_Type_free( &r->column );
+}
@@ -0,0 +1,29 @@
+/* Mixed precision iterative refinement for the Poisson solver */
+
+#ifndef POISSON_REFINE_H
+#define POISSON_REFINE_H
+
+#include <stddef.h>
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+/* The solution in double precision, with a single ghost layer. The
+   corrections are solved for in single precision and added here. */
+typedef struct {
+  int nx, ny;
+  ptrdiff_t stride;       // Distance between two rows, in doubles
+  double *u;              // The point j=0, i=0 is u[0]
+  MPI_Datatype column;    // A column of the interior rows
+} refine_t;
+
+#define REFINE(r, j, i) ((r)->u[(ptrdiff_t)(j)*(r)->stride + (i)])
+
+int refine_init( refine_t *r, const field_t *u );
+double refine_residual( refine_t *r, const field_t *rho, float hsq, field_t *res, const decomp_t *d );
+void refine_correct( refine_t *r, const field_t *e );
+void refine_store( const refine_t *r, field_t *u );
+void refine_free( refine_t *r );
+
+#endif
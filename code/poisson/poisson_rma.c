@@ -0,0 +1,136 @@
+/* Halo exchange with one-sided communication */
+
+/* With MPI_Put a rank writes its boundary straight into the ghost
+   layer of the neighbour. There is no matching of sends and
+   receives and no ordering of the messages between the pairs of
+   neighbours. The neighbour only has to expose its field while the
+   ghost layer may be written, which the general active target
+   synchronisation limits to the ranks that actually communicate. */
+
+#include "poisson_rma.h"
+
+
+/* Tags of the messages setting up the windows, after those of
+   poisson_halo.c and poisson_window.c */
+enum {
+  TAG_RMA_SHAPE = 8,
+  TAG_RMA_ORIGIN
+};
+
+
+/* Work out where the boundary goes in the fields of the neighbours.
+   Their blocks may differ in size by one point, so the shapes are
+   exchanged first. */
+void halo_rma_init( halo_rma_t *r, const decomp_t *d ){
+  int shape[2] = { d->nx, d->ny }, shapes[4][2], rank[4], members[4], n_members = 0;
+  MPI_Request requests[8];
+  MPI_Group group;
+
+  decomp_neighbours( d, rank );
+  for( int k=0; k<4; k++ ){
+    shapes[k][0] = d->nx;
+    shapes[k][1] = d->ny;
+    MPI_Irecv( shapes[k], 2, MPI_INT, rank[k], TAG_RMA_SHAPE, d->comm, &requests[k] );
+    MPI_Isend( shape, 2, MPI_INT, rank[k], TAG_RMA_SHAPE, d->comm, &requests[4+k] );
+  }
+  MPI_Waitall( 8, requests, MPI_STATUSES_IGNORE );
+
+  // The offsets from the point j=0, i=0 of the neighbour
+#define OFFSET(nx, j, i) ((MPI_Aint)(j)*field_stride(nx, 1) + (i))
+  r->target[0] = OFFSET( shapes[0][0], shapes[0][1]+1, 1 );
+  r->target[1] = OFFSET( shapes[1][0], 0, 1 );
+  r->target[2] = OFFSET( shapes[2][0], 1, shapes[2][0]+1 );
+  r->target[3] = OFFSET( shapes[3][0], 1, 0 );
+#undef OFFSET
+
+  for( int k=0; k<2; k++ ){
+    MPI_Type_vector( d->ny, 1, field_stride(shapes[2+k][0], 1), MPI_FLOAT, &r->column[k] );
+    MPI_Type_commit( &r->column[k] );
+  }
+
+  // Only the ranks at the other end of a put take part in the epochs
+  for( int k=0; k<4; k++ )
+    if( rank[k] != MPI_PROC_NULL ) members[n_members++] = rank[k];
+  MPI_Comm_group( d->comm, &group );
+  MPI_Group_incl( group, n_members, members, &r->neighbours );
+  MPI_Group_free( &group );
+
+  r->n_fields = 0;
+}
+
+
+/* Allocate f for the block of d in a window, with a single ghost
+   layer. The library may place the memory where the network or the
+   other ranks on the node can reach it directly, which it cannot do
+   for a window created over memory from malloc. All ranks of the
+   decomposition must call this together. Returns 0 on success and
+   -1 if there is no room for another field. */
+int halo_rma_alloc( halo_rma_t *r, field_t *f, const decomp_t *d ){
+  int n = r->n_fields, rank[4];
+  MPI_Request requests[8];
+  MPI_Aint origin;
+  float *base;
+
+  if( n == HALO_RMA_FIELDS ) return -1;
+
+  // A cache line to spare for the alignment
+  MPI_Win_allocate( field_size(d->nx, d->ny, 1) + FIELD_ALIGNMENT, sizeof(float),
+                    MPI_INFO_NULL, d->comm, &base, &r->win[n] );
+  field_wrap( f, decomp_align_window(base), d->nx, d->ny, 1 );
+  r->data[n] = f->data;
+
+  // The alignment moves the field by a different amount on each rank
+  origin = f->origin - base;
+  decomp_neighbours( d, rank );
+  for( int k=0; k<4; k++ ){
+    MPI_Irecv( &r->origin[n][k], 1, MPI_AINT, rank[k], TAG_RMA_ORIGIN, d->comm, &requests[k] );
+    MPI_Isend( &origin, 1, MPI_AINT, rank[k], TAG_RMA_ORIGIN, d->comm, &requests[4+k] );
+  }
+  MPI_Waitall( 8, requests, MPI_STATUSES_IGNORE );
+
+  r->n_fields++;
+  return 0;
+}
+
+
+/* Fill the ghost layer of u, without the corners. u must have been
+   allocated with halo_rma_alloc. */
+void halo_rma_exchange( halo_rma_t *r, field_t *u, const decomp_t *d ){
+  int nx = u->nx, ny = u->ny, rank[4], f = 0;
+  const MPI_Aint *origin;
+  MPI_Win win;
+
+  while( r->data[f] != u->data ) f++;
+  win = r->win[f];
+  origin = r->origin[f];
+  decomp_neighbours( d, rank );
+
+  // Open the ghost layer to the neighbours, and wait for them to
+  // open theirs. The boundary is not written during the epoch.
+  MPI_Win_post( r->neighbours, 0, win );
+  MPI_Win_start( r->neighbours, 0, win );
+
+  if( rank[0] != MPI_PROC_NULL )
+    MPI_Put( &FIELD(u,1,1), nx, MPI_FLOAT, rank[0], origin[0] + r->target[0], nx, MPI_FLOAT, win );
+  if( rank[1] != MPI_PROC_NULL )
+    MPI_Put( &FIELD(u,ny,1), nx, MPI_FLOAT, rank[1], origin[1] + r->target[1], nx, MPI_FLOAT, win );
+  if( rank[2] != MPI_PROC_NULL )
+    MPI_Put( &FIELD(u,1,1), 1, d->column, rank[2], origin[2] + r->target[2], 1, r->column[0], win );
+  if( rank[3] != MPI_PROC_NULL )
+    MPI_Put( &FIELD(u,1,nx), 1, d->column, rank[3], origin[3] + r->target[3], 1, r->column[1], win );
+
+  // The puts of this rank are done, then those into it
+  MPI_Win_complete( win );
+  MPI_Win_wait( win );
+}
+
+
+/* Free the windows and with them the memory of the fields */
+void halo_rma_free( halo_rma_t *r ){
+  for( int f=0; f < r->n_fields; f++ )
+    MPI_Win_free( &r->win[f] );
+  r->n_fields = 0;
+  for( int k=0; k<2; k++ )
+    MPI_Type_free( &r->column[k] );
+  MPI_Group_free( &r->neighbours );
+}
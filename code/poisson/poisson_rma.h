@@ -0,0 +1,33 @@
+/* Halo exchange with one-sided communication */
+
+#ifndef POISSON_RMA_H
+#define POISSON_RMA_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+/* Fields allocated in windows, into which the neighbours put their
+   boundary rows and columns. Each exchange is an access and exposure
+   epoch of post, start, complete and wait with the neighbours only.
+   The fields are found by their memory, so they may be swapped with
+   field_swap. The directions are ordered down, up, left and right. */
+#define HALO_RMA_FIELDS 2
+typedef struct {
+  MPI_Group neighbours;      // The ranks putting into this one and put into
+  MPI_Aint target[4];        // Where the boundary goes in the field of each neighbour,
+                             // from its point j=0, i=0
+  MPI_Datatype column[2];    // A ghost column of the left and of the right neighbour
+  int n_fields;
+  MPI_Win win[HALO_RMA_FIELDS];
+  const float *data[HALO_RMA_FIELDS];
+  MPI_Aint origin[HALO_RMA_FIELDS][4];  // The point j=0, i=0 in the window of each neighbour
+} halo_rma_t;
+
+void halo_rma_init( halo_rma_t *r, const decomp_t *d );
+int halo_rma_alloc( halo_rma_t *r, field_t *f, const decomp_t *d );
+void halo_rma_exchange( halo_rma_t *r, field_t *u, const decomp_t *d );
+void halo_rma_free( halo_rma_t *r );
+
+#endif
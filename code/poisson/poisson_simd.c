@@ -0,0 +1,188 @@
+/* Vectorised row kernels for the Jacobi update */
+
+/* The kernels are compiled for each instruction set with target
+   attributes, so a single binary contains all of them and the
+   fastest one supported by the processor is picked at startup.
+   Each kernel computes the same points as jacobi_row_scalar, with
+   the same float arithmetic. Only the order of the sum of the
+   squared change differs, since it is accumulated in double
+   precision in several lanes at once. */
+
+#include <string.h>
+
+#include "poisson_kernels.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+/* The reference row kernel. Updates the points i=1..nx and adds
+   the squared change to unorm. */
+double jacobi_row_scalar( double unorm, float *newrow, const float *up, const float *mid,
+                          const float *down, const float *rhorow, float hsq, int nx ){
+  for( int i=1; i <= nx; i++){
+    float difference = mid[i-1] + mid[i+1] + up[i] + down[i];
+    float unew = 0.25*( difference - hsq*rhorow[i] );
+    float diff = unew - mid[i];
+    newrow[i] = unew;
+    unorm += diff*diff;
+  }
+  return unorm;
+}
+
+
+#ifdef HAVE_X86_KERNELS
+
+__attribute__((target("sse2")))
+static double jacobi_row_sse2( double unorm, float *newrow, const float *up, const float *mid,
+                               const float *down, const float *rhorow, float hsq, int nx ){
+  __m128 quarter = _mm_set1_ps(0.25f);
+  __m128 vhsq = _mm_set1_ps(hsq);
+  __m128d sum = _mm_setzero_pd();
+  double partial[2];
+  int i;
+
+  for( i=1; i+3 <= nx; i+=4 ){
+    __m128 centre = _mm_loadu_ps(mid+i);
+    __m128 difference = _mm_add_ps( _mm_add_ps( _mm_add_ps(
+                          _mm_loadu_ps(mid+i-1), _mm_loadu_ps(mid+i+1) ),
+                          _mm_loadu_ps(up+i) ), _mm_loadu_ps(down+i) );
+    __m128 unew = _mm_mul_ps( quarter,
+                    _mm_sub_ps( difference, _mm_mul_ps( vhsq, _mm_loadu_ps(rhorow+i) ) ) );
+    __m128 diff = _mm_sub_ps( unew, centre );
+    __m128 square = _mm_mul_ps( diff, diff );
+    _mm_storeu_ps( newrow+i, unew );
+
+    // Widen to double, the low and the high half separately
+    sum = _mm_add_pd( sum, _mm_cvtps_pd(square) );
+    sum = _mm_add_pd( sum, _mm_cvtps_pd( _mm_movehl_ps(square, square) ) );
+  }
+
+  _mm_storeu_pd( partial, sum );
+  unorm += partial[0] + partial[1];
+
+  // The remaining points
+  return jacobi_row_scalar( unorm, newrow+i-1, up+i-1, mid+i-1, down+i-1, rhorow+i-1, hsq, nx-i+1 );
+}
+
+
+__attribute__((target("avx2")))
+static double jacobi_row_avx2( double unorm, float *newrow, const float *up, const float *mid,
+                               const float *down, const float *rhorow, float hsq, int nx ){
+  __m256 quarter = _mm256_set1_ps(0.25f);
+  __m256 vhsq = _mm256_set1_ps(hsq);
+  __m256d sum_low = _mm256_setzero_pd();
+  __m256d sum_high = _mm256_setzero_pd();
+  double partial[4];
+  int i;
+
+  for( i=1; i+7 <= nx; i+=8 ){
+    __m256 centre = _mm256_loadu_ps(mid+i);
+    __m256 difference = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps(
+                          _mm256_loadu_ps(mid+i-1), _mm256_loadu_ps(mid+i+1) ),
+                          _mm256_loadu_ps(up+i) ), _mm256_loadu_ps(down+i) );
+    __m256 unew = _mm256_mul_ps( quarter,
+                    _mm256_sub_ps( difference, _mm256_mul_ps( vhsq, _mm256_loadu_ps(rhorow+i) ) ) );
+    __m256 diff = _mm256_sub_ps( unew, centre );
+    __m256 square = _mm256_mul_ps( diff, diff );
+    _mm256_storeu_ps( newrow+i, unew );
+
+    sum_low = _mm256_add_pd( sum_low, _mm256_cvtps_pd( _mm256_castps256_ps128(square) ) );
+    sum_high = _mm256_add_pd( sum_high, _mm256_cvtps_pd( _mm256_extractf128_ps(square, 1) ) );
+  }
+
+  _mm256_storeu_pd( partial, _mm256_add_pd(sum_low, sum_high) );
+  unorm += (partial[0] + partial[1]) + (partial[2] + partial[3]);
+
+  return jacobi_row_scalar( unorm, newrow+i-1, up+i-1, mid+i-1, down+i-1, rhorow+i-1, hsq, nx-i+1 );
+}
+
+
+__attribute__((target("avx512f")))
+static double jacobi_row_avx512( double unorm, float *newrow, const float *up, const float *mid,
+                                 const float *down, const float *rhorow, float hsq, int nx ){
+  __m512 quarter = _mm512_set1_ps(0.25f);
+  __m512 vhsq = _mm512_set1_ps(hsq);
+  __m512d sum_low = _mm512_setzero_pd();
+  __m512d sum_high = _mm512_setzero_pd();
+
+  // The last vector is masked, points outside the row are read
+  // as zeros and give no change
+  for( int i=1; i <= nx; i+=16 ){
+    __mmask16 mask = nx-i >= 15 ? 0xFFFF : (__mmask16)((1u << (nx-i+1)) - 1);
+    __m512 centre = _mm512_maskz_loadu_ps(mask, mid+i);
+    __m512 difference = _mm512_add_ps( _mm512_add_ps( _mm512_add_ps(
+                          _mm512_maskz_loadu_ps(mask, mid+i-1), _mm512_maskz_loadu_ps(mask, mid+i+1) ),
+                          _mm512_maskz_loadu_ps(mask, up+i) ), _mm512_maskz_loadu_ps(mask, down+i) );
+    __m512 unew = _mm512_mul_ps( quarter,
+                    _mm512_sub_ps( difference, _mm512_mul_ps( vhsq, _mm512_maskz_loadu_ps(mask, rhorow+i) ) ) );
+    __m512 diff = _mm512_sub_ps( unew, centre );
+    __m512 square = _mm512_mul_ps( diff, diff );
+    _mm512_mask_storeu_ps( newrow+i, mask, unew );
+
+    sum_low = _mm512_add_pd( sum_low, _mm512_cvtps_pd( _mm512_castps512_ps256(square) ) );
+    sum_high = _mm512_add_pd( sum_high, _mm512_cvtps_pd( _mm256_castpd_ps(
+                 _mm512_extractf64x4_pd( _mm512_castps_pd(square), 1 ) ) ) );
+  }
+
+  return unorm + _mm512_reduce_add_pd( _mm512_add_pd(sum_low, sum_high) );
+}
+
+#endif
+
+
+/* Find the instruction set matching a command line name */
+int isa_from_name( const char *name ){
+  if( strcmp(name, "auto") == 0 ) return ISA_AUTO;
+  if( strcmp(name, "scalar") == 0 ) return ISA_SCALAR;
+  if( strcmp(name, "sse2") == 0 ) return ISA_SSE2;
+  if( strcmp(name, "avx2") == 0 ) return ISA_AVX2;
+  if( strcmp(name, "avx512") == 0 ) return ISA_AVX512;
+  return -1;
+}
+
+const char *isa_name( int isa ){
+  static const char *names[] = { "scalar", "sse2", "avx2", "avx512" };
+  if( isa < ISA_SCALAR || isa > ISA_AVX512 ) return "auto";
+  return names[isa];
+}
+
+
+/* Check whether the processor supports an instruction set */
+int isa_supported( int isa ){
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  switch( isa ){
+    case ISA_SCALAR: return 1;
+    case ISA_SSE2: return __builtin_cpu_supports("sse2");
+    case ISA_AVX2: return __builtin_cpu_supports("avx2");
+    case ISA_AVX512: return __builtin_cpu_supports("avx512f");
+  }
+  return 0;
+#else
+  return isa == ISA_SCALAR;
+#endif
+}
+
+
+/* Return the row kernel for an instruction set. ISA_AUTO picks the
+   widest one the processor supports. Returns NULL if the
+   instruction set is not supported. */
+jacobi_row_t jacobi_row_kernel( int *isa ){
+  if( *isa == ISA_AUTO ){
+    *isa = ISA_AVX512;
+    while( !isa_supported(*isa) ) (*isa)--;
+  }
+  if( !isa_supported(*isa) ) return NULL;
+
+  switch( *isa ){
+#ifdef HAVE_X86_KERNELS
+    case ISA_SSE2: return jacobi_row_sse2;
+    case ISA_AVX2: return jacobi_row_avx2;
+    case ISA_AVX512: return jacobi_row_avx512;
+#endif
+    default: return jacobi_row_scalar;
+  }
+}
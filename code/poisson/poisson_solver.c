@@ -0,0 +1,790 @@
+/* A parallel Poisson solver with the grid size set at run time */
+
+/* Compile with
+     mpicc -O3 -o poisson_solver poisson_solver.c poisson_field.c \
+           poisson_kernels.c poisson_simd.c poisson_decomp.c \
+           poisson_halo.c poisson_multigrid.c poisson_cg.c \
+           poisson_convergence.c poisson_window.c poisson_rma.c \
+           poisson_refine.c poisson_io.c -lm
+   and run for example with
+     mpirun -n 4 ./poisson_solver -n 1024 -r 1e-3
+   Add -fopenmp to share the loops over the rows of each rank between
+   threads, with OMP_NUM_THREADS threads per rank.
+   Options:
+     -n gridsize    number of interior points in each direction
+     -h stepsize    lattice spacing
+     -r residual    stop when the change of the field is below this
+     -i iterations  maximum number of iterations
+     -p             start from u=10 at the single point x=1, y=1
+                    instead of the u=10 boundary at x=0
+     -k kernel      reference: update and norm in separate passes
+                    fused: update and norm in one pass (default)
+                    tiled: several fused sweeps per cache sized tile
+     -T width       number of columns in a tile of the tiled kernel
+     -d depth       number of sweeps per tile in the tiled kernel.
+                    With more than one rank the halo is depth layers
+                    deep and exchanged once for the depth sweeps, as
+                    with -G. The tiles run on a single thread.
+     -o             overlap the halo exchange with the update of the
+                    interior points (jacobi with the fused kernel)
+     -G layers      keep this many ghost layers and exchange them once
+                    every layers sweeps, updating the ghost points
+                    as well (jacobi with the fused or tiled kernel,
+                    also with -R)
+     -D dims        shape of the grid of ranks, as rows x columns,
+                    for example 4x2 or 8x1 for slabs. A zero is
+                    chosen by MPI_Dims_create, the default is 0x0
+     -m method      jacobi: Jacobi iteration (default)
+                    gs: red-black Gauss-Seidel
+                    sor: red-black successive over-relaxation
+                    mg: multigrid V-cycles
+                    fmg: a full multigrid cycle followed by V-cycles
+                    cg: conjugate gradient
+                    pipecg: pipelined conjugate gradient, with a
+                    single non-blocking reduction per iteration
+     -w omega       over-relaxation parameter of sor, by default the
+                    optimal value for the grid size
+     -P precond     preconditioner of cg and pipecg: none (default),
+                    jacobi or ic (incomplete Cholesky on each rank)
+     -a isa         instruction set of the fused kernel: scalar, sse2,
+                    avx2, avx512 or auto (default, the widest supported)
+     -H halo        how the columns of the halo are sent: datatype
+                    (default) straight from the field with a strided
+                    type, pack through contiguous buffers, or shared:
+                    u in shared memory, read directly by the
+                    neighbours on the same node (jacobi, gs and sor),
+                    or rma: put into the ghost layers of the
+                    neighbours with one-sided communication (jacobi,
+                    gs and sor)
+     -R             exchange the halo with persistent requests, set up
+                    once for the run (jacobi, gs and sor)
+     -c every       sum the change over the ranks and check for
+                    convergence only every this many iterations
+     -A             start the sum at a check without waiting and
+                    use it at the next check. The conjugate gradient
+                    methods ignore -c and -A, their reductions
+                    include the change.
+     -e residual    iterative refinement: keep the solution in double
+                    precision and solve for corrections in single
+                    precision until the residual of the equation has
+                    dropped by this factor. The first solve stops at
+                    the change set by -r, the later ones at the same
+                    change relative to their residual.
+     -C every       write a checkpoint of u every this many
+                    iterations, in the background while the
+                    iterations go on. The checkpoint is a field
+                    file like those of -O.
+     -W file        where the checkpoints go, poisson_checkpoint.bin
+                    by default
+     -I file        restart from a checkpoint or a field file of the
+                    same grid size, on any number of ranks. The
+                    conjugate gradient methods start a new search
+                    from the field.
+     -O file        write the final field, with the boundary, to a
+                    single binary file with MPI-IO. poisson_convert
+                    turns it into text.
+     -b repeats     time this many halo exchanges of each kind on the
+                    grid of ranks and stop without solving (not with
+                    -G, the exchanges are of a single layer)
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "poisson_field.h"
+#include "poisson_kernels.h"
+#include "poisson_decomp.h"
+#include "poisson_halo.h"
+#include "poisson_multigrid.h"
+#include "poisson_cg.h"
+#include "poisson_convergence.h"
+#include "poisson_window.h"
+#include "poisson_rma.h"
+#include "poisson_refine.h"
+#include "poisson_io.h"
+
+
+/* The iterative methods */
+enum {
+  METHOD_JACOBI,
+  METHOD_GS,
+  METHOD_SOR,
+  METHOD_MG,
+  METHOD_FMG,
+  METHOD_CG,
+  METHOD_PIPECG
+};
+
+/* Options for running an iteration */
+typedef struct {
+  int method;        // One of the METHOD_ values
+  int kernel;        // KERNEL_REFERENCE, KERNEL_FUSED or KERNEL_TILED
+  int tile_width;    // Columns in a tile of the tiled kernel
+  int depth;         // Sweeps in one iteration of the tiled kernel
+  float omega;       // Over-relaxation parameter
+  int precond;       // Preconditioner of the conjugate gradient methods
+  int overlap;       // Update the interior during the halo exchange
+  int persistent;    // Exchange the halo with persistent requests
+  int layers;        // Ghost layers, Jacobi sweeps per halo exchange
+} step_options;
+
+
+/* Find the method matching a command line name, -1 if none does */
+static int method_from_name( const char *name ){
+  if( strcmp(name, "jacobi") == 0 ) return METHOD_JACOBI;
+  if( strcmp(name, "gs") == 0 ) return METHOD_GS;
+  if( strcmp(name, "sor") == 0 ) return METHOD_SOR;
+  if( strcmp(name, "mg") == 0 ) return METHOD_MG;
+  if( strcmp(name, "fmg") == 0 ) return METHOD_FMG;
+  if( strcmp(name, "cg") == 0 ) return METHOD_CG;
+  if( strcmp(name, "pipecg") == 0 ) return METHOD_PIPECG;
+  return -1;
+}
+
+
+/* Fill the ghost layer of u, through the shared memory of window,
+   with the puts of rma or with the persistent requests of plan if
+   there is one. The puts and the persistent requests leave out the
+   corners, which the Jacobi and red-black updates do not read,
+   except for the persistent requests of a deep halo. */
+static void exchange( field_t *u, const decomp_t *d, halo_plan_t *plan,
+                      halo_window_t *window, halo_rma_t *rma ){
+  if( window != NULL ){
+    halo_window_exchange( window, u, d );
+  } else if( rma != NULL ){
+    halo_rma_exchange( rma, u, d );
+  } else if( plan == NULL ){
+    halo_exchange( u, d );
+  } else {
+    halo_plan_begin( plan, u, d );
+    halo_plan_end( plan, u, d );
+  }
+}
+
+
+/* Run u->halo Jacobi sweeps after a single exchange of the deep
+   halo. Each sweep also updates the ghost points that the following
+   sweeps read, so the updated region shrinks by a layer per sweep.
+   The ghost points at the edges of the grid hold the boundary and
+   are not updated. Returns the change of the interior in the last
+   sweep, the result is in u. plan holds the persistent requests for
+   u and unew or is NULL. */
+static double jacobi_deep( field_t *u, field_t *unew, const field_t *rho, float hsq,
+                           const decomp_t *d, halo_plan_t *plan ){
+  int nx = u->nx, ny = u->ny;
+  double unorm = 0.0;
+
+  exchange( u, d, plan, NULL, NULL );
+  for( int extra = u->halo-1; extra >= 0; extra-- ){
+    int down = d->down == MPI_PROC_NULL ? 0 : extra;
+    int up = d->up == MPI_PROC_NULL ? 0 : extra;
+    int left = d->left == MPI_PROC_NULL ? 0 : extra;
+    int right = d->right == MPI_PROC_NULL ? 0 : extra;
+
+    // The change of the ghost points is not counted
+    jacobi_block( u, unew, rho, hsq, 1-down, 0, 1-left, nx+right, 0.0 );
+    jacobi_block( u, unew, rho, hsq, ny+1, ny+up, 1-left, nx+right, 0.0 );
+    jacobi_block( u, unew, rho, hsq, 1, ny, 1-left, 0, 0.0 );
+    jacobi_block( u, unew, rho, hsq, 1, ny, nx+1, nx+right, 0.0 );
+    unorm = jacobi_block( u, unew, rho, hsq, 1, ny, 1, nx, 0.0 );
+    field_swap( u, unew );
+  }
+  return unorm;
+}
+
+
+/* Run one iteration and return the change in the field on this
+   rank. The caller sums it over the ranks when it checks for
+   convergence. With the tiled kernel or a deep halo an iteration
+   consists of opts->depth sweeps and the change is that of the last
+   sweep.
+   The red-black methods update the two colours one after the
+   other and exchange the halo before each. The multigrid methods
+   run one cycle per iteration. The conjugate gradient methods sum
+   the change over the ranks with their own reductions and return
+   the sum. d describes the block of
+   this rank and its neighbours. plan holds the persistent requests
+   for u and unew, window their shared memory and rma their one-sided
+   windows, or they are NULL. */
+double poisson_step(
+    field_t *u,
+    field_t *unew,
+    const field_t *rho,
+    float hsq,
+    const step_options *opts,
+    const decomp_t *d,
+    multigrid_t *mg,
+    cg_t *cg,
+    halo_plan_t *plan,
+    halo_window_t *window,
+    halo_rma_t *rma
+  ){
+  double unorm;
+
+  if( opts->method == METHOD_CG || opts->method == METHOD_PIPECG ){
+    return cg_iteration( cg, u, rho, hsq );
+  }
+
+  if( opts->method == METHOD_MG || opts->method == METHOD_FMG ){
+    // Start with a full multigrid cycle if requested
+    int full = opts->method == METHOD_FMG && mg->cycles == 0;
+    return multigrid_cycle( mg, u, unew, rho, full );
+  }
+
+  if( opts->method != METHOD_JACOBI ){
+    unorm = 0.0;
+    for( int parity=0; parity<2; parity++ ){
+      exchange( u, d, plan, window, rma );
+      unorm += relax_colour( u, rho, hsq, opts->omega, parity, d->j_offset + d->i_offset );
+    }
+    return unorm;
+  }
+
+  if( opts->overlap ){
+    MPI_Request requests[HALO_REQUESTS];
+    int nx = u->nx, ny = u->ny;
+
+    // The points away from the edges of the block only need local
+    // values, update them while the halo is on its way. The rows
+    // and columns next to the ghost layer follow once it has
+    // arrived.
+    if( plan ) halo_plan_begin( plan, u, d );
+    else halo_begin( u, d, requests );
+    unorm = jacobi_block( u, unew, rho, hsq, 2, ny-1, 2, nx-1, 0.0 );
+    if( plan ) halo_plan_end( plan, u, d );
+    else halo_end( u, d, requests );
+    unorm = jacobi_block( u, unew, rho, hsq, 1, 1, 1, nx, unorm );
+    if( ny > 1 ) unorm = jacobi_block( u, unew, rho, hsq, ny, ny, 1, nx, unorm );
+    unorm = jacobi_block( u, unew, rho, hsq, 2, ny-1, 1, 1, unorm );
+    if( nx > 1 ) unorm = jacobi_block( u, unew, rho, hsq, 2, ny-1, nx, nx, unorm );
+    field_swap( u, unew );
+    return unorm;
+  }
+
+  if( opts->layers > 1 && opts->kernel != KERNEL_TILED ){
+    return jacobi_deep( u, unew, rho, hsq, d, plan );
+  }
+
+  // Fill the ghost layer from the neighbouring ranks
+  exchange( u, d, plan, window, rma );
+
+  // Update the field, the result is in u afterwards. With a deep
+  // halo the tiles also update the ghost layers of the neighbours.
+  if( opts->kernel == KERNEL_TILED ){
+    int ghosts[4];
+
+    decomp_neighbours( d, ghosts );
+    for( int k=0; k<4; k++ ) ghosts[k] = u->halo > 1 && ghosts[k] != MPI_PROC_NULL;
+    unorm = jacobi_sweep_tiled( u, unew, rho, hsq, opts->tile_width, opts->depth, ghosts );
+  } else {
+    unorm = jacobi_sweep( u, unew, rho, hsq, opts->kernel );
+  }
+
+  return unorm;
+}
+
+
+/* Time repeats halo exchanges of u and return the time per exchange
+   of the slowest rank */
+static double time_exchanges( field_t *u, const decomp_t *d, halo_plan_t *plan,
+                              halo_window_t *window, halo_rma_t *rma, int repeats ){
+  double start, time, max_time;
+
+  // The first exchange sets up the connections
+  exchange( u, d, plan, window, rma );
+  MPI_Barrier( d->comm );
+  start = MPI_Wtime();
+  for( int r=0; r<repeats; r++ )
+    exchange( u, d, plan, window, rma );
+  time = MPI_Wtime() - start;
+
+  MPI_Allreduce( &time, &max_time, 1, MPI_DOUBLE, MPI_MAX, d->comm );
+  return max_time/repeats;
+}
+
+
+/* Time the halo exchange with each way of sending the columns, with
+   new requests in every exchange and with persistent requests,
+   through shared memory and with one-sided puts */
+static void halo_benchmark( field_t *u, decomp_t *d, int repeats ){
+  int halo = d->halo, rank;
+  halo_window_t window;
+  halo_rma_t rma;
+  field_t shared;
+  double time;
+
+  MPI_Comm_rank( d->comm, &rank );
+  for( d->halo=HALO_DATATYPE; d->halo<=HALO_PACK; d->halo++ ){
+    halo_plan_t plan;
+    double blocking, persistent;
+
+    halo_plan_init( &plan );
+    halo_plan_add( &plan, u, d );
+    blocking = time_exchanges( u, d, NULL, NULL, NULL, repeats );
+    persistent = time_exchanges( u, d, &plan, NULL, NULL, repeats );
+    halo_plan_free( &plan );
+
+    if( rank == 0 )
+      printf("Halo exchange with %-8s %10.3f us, persistent %10.3f us\n",
+             halo_name(d->halo), 1e6*blocking, 1e6*persistent);
+  }
+
+  halo_window_init( &window, d );
+  halo_window_alloc( &window, &shared, d );
+  field_copy( &shared, u );
+  time = time_exchanges( &shared, d, NULL, &window, NULL, repeats );
+  halo_window_free( &window );
+  if( rank == 0 )
+    printf("Halo exchange with %-8s %10.3f us\n", halo_name(HALO_SHARED), 1e6*time);
+
+  halo_rma_init( &rma, d );
+  halo_rma_alloc( &rma, &shared, d );
+  field_copy( &shared, u );
+  time = time_exchanges( &shared, d, NULL, NULL, &rma, repeats );
+  halo_rma_free( &rma );
+  if( rank == 0 )
+    printf("Halo exchange with %-8s %10.3f us\n", halo_name(HALO_RMA), 1e6*time);
+  d->halo = halo;
+}
+
+
+/* Iterate from the given iteration until the change summed over the
+   ranks is below the residual of check, or until max_iter. check
+   must have been set up with convergence_init. With a checkpoint u
+   is saved every checkpoint_every iterations. Returns the number of
+   the last iteration. */
+static int solve(
+    field_t *u,
+    field_t *unew,
+    const field_t *rho,
+    float hsq,
+    const step_options *opts,
+    const decomp_t *d,
+    multigrid_t *mg,
+    cg_t *cg,
+    halo_plan_t *plan,
+    halo_window_t *window,
+    halo_rma_t *rma,
+    convergence_t *check,
+    checkpoint_t *checkpoint,
+    int checkpoint_every,
+    int iteration,
+    int max_iter
+  ){
+  int cg_method = opts->method == METHOD_CG || opts->method == METHOD_PIPECG;
+  int converged;
+  double unorm;
+
+  do {
+    unorm = poisson_step( u, unew, rho, hsq, opts, d, mg, cg, plan, window, rma );
+    iteration += opts->depth;
+    if( cg_method ){
+      check->unorm = unorm;
+      check->unorm_iteration = iteration;
+      converged = unorm <= check->residual;
+    } else {
+      converged = convergence_check( check, iteration, unorm );
+    }
+    if( checkpoint != NULL && iteration % checkpoint_every < opts->depth )
+      checkpoint_save( checkpoint, u, d, iteration );
+  } while( !converged && iteration < max_iter );
+  convergence_finish( check );
+
+  return iteration;
+}
+
+
+/* Print the options and stop */
+static void usage( const char *name, int rank ){
+   if( rank == 0 )
+      fprintf(stderr, "Usage: %s [-n gridsize] [-h stepsize] [-r residual] [-i iterations] [-p] [-k kernel] [-a isa] [-T width] [-d depth] [-o] [-G layers] [-D dims] [-m method] [-w omega] [-P precond] [-H halo] [-R] [-c every] [-A] [-e residual] [-C every] [-W file] [-I file] [-O file] [-b repeats]\n", name);
+   MPI_Abort(MPI_COMM_WORLD, 1);
+}
+
+
+int main(int argc, char** argv) {
+   field_t u, unew, rho, res;
+   decomp_t d;
+   int dims[2] = { 0, 0 };
+   multigrid_t mg;
+   cg_t cg;
+   int gridsize = 512, max_iter = 100000, point_source = 0;
+   int halo = HALO_DATATYPE, benchmark = 0, check_every = 1, check_async = 0;
+   int cg_method, step;
+   convergence_t check;
+   refine_t refine;
+   step_options opts = { METHOD_JACOBI, KERNEL_FUSED, 1024, 8, 0.0, PRECOND_NONE, 0, 0, 1 };
+   halo_plan_t plan;
+   halo_window_t window;
+   halo_rma_t rma;
+   const char *output = NULL, *restart = NULL, *checkpoint_file = "poisson_checkpoint.bin";
+   int checkpoint_every = 0, first_iteration = 0;
+   checkpoint_t checkpoint;
+   int isa = ISA_AUTO;
+   float h = 0.1, hsq;
+   double residual = 1e-3, refine_residual_factor = 0.0, rnorm, rnorm0;
+   int rank, n_ranks, iteration, opt, width, min_width, thread_support;
+
+   // First call MPI_Init. Only the main thread calls MPI, outside
+   // the threaded loops.
+   MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
+   MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+   MPI_Comm_size(MPI_COMM_WORLD, &n_ranks);
+   if( thread_support < MPI_THREAD_FUNNELED ){
+      if( rank == 0 )
+         fprintf(stderr, "The MPI library does not support threads\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+#ifdef _OPENMP
+   if( rank == 0 )
+      printf("Using %d threads per rank\n", omp_get_max_threads());
+#endif
+
+   // Read parameters from the command line
+   while( (opt = getopt(argc, argv, "n:h:r:i:pk:a:T:d:oG:D:m:w:P:H:Rc:Ae:C:W:I:O:b:")) != -1 ){
+      switch( opt ){
+         case 'n': gridsize = atoi(optarg); break;
+         case 'h': h = atof(optarg); break;
+         case 'r': residual = atof(optarg); break;
+         case 'i': max_iter = atoi(optarg); break;
+         case 'p': point_source = 1; break;
+         case 'k':
+            opts.kernel = kernel_from_name(optarg);
+            if( opts.kernel < 0 ) usage(argv[0], rank);
+            break;
+         case 'a':
+            isa = isa_from_name(optarg);
+            if( isa < ISA_AUTO ) usage(argv[0], rank);
+            break;
+         case 'T': opts.tile_width = atoi(optarg); break;
+         case 'd': opts.depth = atoi(optarg); break;
+         case 'o': opts.overlap = 1; break;
+         case 'G': opts.layers = atoi(optarg); break;
+         case 'D':
+            if( sscanf(optarg, "%dx%d", &dims[0], &dims[1]) != 2 ) usage(argv[0], rank);
+            break;
+         case 'm':
+            opts.method = method_from_name(optarg);
+            if( opts.method < 0 ) usage(argv[0], rank);
+            break;
+         case 'w': opts.omega = atof(optarg); break;
+         case 'P':
+            opts.precond = precond_from_name(optarg);
+            if( opts.precond < 0 ) usage(argv[0], rank);
+            break;
+         case 'H':
+            halo = halo_from_name(optarg);
+            if( halo < 0 ) usage(argv[0], rank);
+            break;
+         case 'R': opts.persistent = 1; break;
+         case 'c': check_every = atoi(optarg); break;
+         case 'A': check_async = 1; break;
+         case 'e': refine_residual_factor = atof(optarg); break;
+         case 'C': checkpoint_every = atoi(optarg); break;
+         case 'W': checkpoint_file = optarg; break;
+         case 'I': restart = optarg; break;
+         case 'O': output = optarg; break;
+         case 'b': benchmark = atoi(optarg); break;
+         default: usage(argv[0], rank);
+      }
+   }
+
+   // Choose the row kernel from the instruction sets of the processor
+   isa = kernel_select_isa( isa );
+   if( isa < 0 ){
+      if( rank == 0 )
+         fprintf(stderr, "The instruction set is not supported by this processor\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+   if( rank == 0 && opts.kernel != KERNEL_REFERENCE )
+      printf("Using the %s row kernel\n", isa_name(isa));
+
+   if( opts.tile_width < 1 || opts.depth < 1 || opts.layers < 1 || check_every < 1
+       || checkpoint_every < 0 )
+      usage(argv[0], rank);
+   if( opts.kernel != KERNEL_TILED || opts.method != METHOD_JACOBI ) opts.depth = 1;
+
+   // With more than one rank the sweeps of a tile after the first
+   // need ghost values that only the neighbours have, so the tiled
+   // kernel gets a deep halo and updates it
+   if( opts.depth > 1 && n_ranks > 1 && opts.layers == 1 ) opts.layers = opts.depth;
+
+   if( opts.overlap && (opts.method != METHOD_JACOBI || opts.kernel != KERNEL_FUSED) ){
+      if( rank == 0 )
+         fprintf(stderr, "Overlapping the halo exchange requires the jacobi method and the fused kernel\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   if( (halo == HALO_SHARED || halo == HALO_RMA)
+       && (opts.method > METHOD_SOR || opts.overlap || opts.persistent || opts.layers > 1) ){
+      if( rank == 0 )
+         fprintf(stderr, "The %s halo is used by the jacobi, gs and sor methods, without -o, -R and -G\n",
+                 halo_name(halo));
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   if( refine_residual_factor > 0.0 && (checkpoint_every > 0 || restart != NULL) ){
+      if( rank == 0 )
+         fprintf(stderr, "Checkpoints and restarts keep the field in single precision, not with -e\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   if( opts.persistent && opts.method != METHOD_JACOBI && opts.method != METHOD_GS
+       && opts.method != METHOD_SOR ){
+      if( rank == 0 )
+         fprintf(stderr, "Persistent requests are used by the jacobi, gs and sor methods\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   if( opts.layers > 1 && (opts.method != METHOD_JACOBI || opts.kernel == KERNEL_REFERENCE
+                           || opts.overlap) ){
+      if( rank == 0 )
+         fprintf(stderr, "A deep halo requires the jacobi method and the fused or tiled kernel, without -o\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   if( benchmark > 0 && opts.layers > 1 ){
+      if( rank == 0 )
+         fprintf(stderr, "The halo benchmark exchanges a single ghost layer, not with -G\n");
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   // Gauss-Seidel is over-relaxation with omega=1
+   if( opts.method == METHOD_GS ) opts.omega = 1.0;
+   if( opts.method == METHOD_SOR && opts.omega == 0.0 ){
+      opts.omega = sor_optimal_omega( gridsize );
+      if( rank == 0 )
+         printf("Using omega = %f\n", opts.omega);
+   }
+
+   if( opts.layers > 1 ) opts.depth = opts.layers;
+
+   /* Split the grid into blocks on a grid of ranks */
+   if( decomp_create( &d, gridsize, gridsize, dims, MPI_COMM_WORLD ) != 0 ){
+      if( rank == 0 )
+         fprintf(stderr, "Cannot split a grid of size %d over %d ranks in a %dx%d grid\n",
+                 gridsize, n_ranks, dims[0], dims[1]);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+   d.halo = halo;
+   if( rank == 0 )
+      printf("Using a %dx%d grid of ranks\n", d.dims[0], d.dims[1]);
+
+   // The ghost layers come from the nearest neighbours only
+   width = d.nx < d.ny ? d.nx : d.ny;
+   MPI_Allreduce( &width, &min_width, 1, MPI_INT, MPI_MIN, d.comm );
+   if( min_width < opts.layers ){
+      if( rank == 0 )
+         fprintf(stderr, "The blocks of the ranks are narrower than %d ghost layers\n", opts.layers);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+   if( decomp_set_depth( &d, opts.layers ) != 0 ){
+      fprintf(stderr, "Rank %d could not allocate the halo buffer\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   /* Reserve memory for the fields. With HALO_SHARED u and unew are
+      in shared memory, with HALO_RMA in windows for one-sided
+      communication. */
+   if( halo == HALO_SHARED ){
+      halo_window_init( &window, &d );
+      halo_window_alloc( &window, &u, &d );
+      halo_window_alloc( &window, &unew, &d );
+   } else if( halo == HALO_RMA ){
+      halo_rma_init( &rma, &d );
+      halo_rma_alloc( &rma, &u, &d );
+      halo_rma_alloc( &rma, &unew, &d );
+   } else if( field_alloc( &u, d.nx, d.ny, opts.layers ) != 0
+           || field_alloc( &unew, d.nx, d.ny, opts.layers ) != 0 ){
+      fprintf(stderr, "Rank %d could not allocate the fields\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+   if( field_alloc( &rho, d.nx, d.ny, opts.layers ) != 0 ){
+      fprintf(stderr, "Rank %d could not allocate the fields\n", rank);
+      MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+
+   /* Run Setup */
+   hsq = h*h;
+
+   // Initialise the u and rho field to 0
+   field_fill( &u, 0.0 );
+   field_fill( &rho, 0.0 );
+
+   if( point_source ){
+      // Start from a configuration with u=10 at x=1 and y=1
+      // on the rank holding the first block
+      if( d.j_offset == 0 && d.i_offset == 0 )
+         FIELD(&u, 1, 1) = 10;
+   } else {
+      // Create a start configuration with the field
+      // u=10 at x=0, on the ranks at the left edge. The ghost rows
+      // of a deep halo hold the boundary as well.
+      if( d.left == MPI_PROC_NULL )
+         for( int j=1-u.halo; j <= d.ny+u.halo; j++ )
+            FIELD(&u, j, 0) = 10.0;
+   }
+
+   // Continue from an earlier run. Its boundary replaces the one set
+   // up here.
+   if( restart != NULL ){
+      int error = field_read( restart, &u, &d, gridsize, gridsize, h, &first_iteration );
+      if( error == -2 ){
+         if( rank == 0 )
+            fprintf(stderr, "Could not restart from %s, it was computed with a step size other than %g\n",
+                    restart, h);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      } else if( error != 0 ){
+         if( rank == 0 )
+            fprintf(stderr, "Could not restart from %s\n", restart);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      if( rank == 0 )
+         printf("Restarting from iteration %d of %s\n", first_iteration, restart);
+   }
+
+   // The boundaries are not updated, so unew needs the same values
+   field_copy( &unew, &u );
+
+   // With a deep halo the source is also needed on the ghost points
+   if( opts.layers > 1 ) halo_exchange( &rho, &d );
+
+   if( benchmark > 0 ){
+      halo_benchmark( &u, &d, benchmark );
+      if( halo == HALO_SHARED ){
+         halo_window_free( &window );
+      } else if( halo == HALO_RMA ){
+         halo_rma_free( &rma );
+      } else {
+         field_free( &u );
+         field_free( &unew );
+      }
+      field_free( &rho );
+      decomp_free( &d );
+      return MPI_Finalize();
+   }
+
+   if( opts.method == METHOD_MG || opts.method == METHOD_FMG ){
+      if( multigrid_setup( &mg, &d, hsq ) != 0 ){
+         fprintf(stderr, "Rank %d could not allocate the multigrid levels\n", rank);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+   }
+   if( opts.method == METHOD_CG || opts.method == METHOD_PIPECG ){
+      if( cg_setup( &cg, &d, opts.precond, opts.method == METHOD_PIPECG ) != 0 ){
+         fprintf(stderr, "Rank %d could not allocate the conjugate gradient vectors\n", rank);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+   }
+
+   // The requests stay valid when u and unew are swapped
+   halo_plan_init( &plan );
+   if( opts.persistent ){
+      halo_plan_add( &plan, &u, &d );
+      halo_plan_add( &plan, &unew, &d );
+   }
+
+   // Run iterations until the field reaches an equilibrium
+   cg_method = opts.method == METHOD_CG || opts.method == METHOD_PIPECG;
+   if( refine_residual_factor <= 0.0 ){
+      convergence_init( &check, d.comm, residual, cg_method ? 1 : check_every, check_async && !cg_method );
+      if( checkpoint_every > 0
+       && checkpoint_init( &checkpoint, checkpoint_file, &u, gridsize, gridsize, h ) != 0 ){
+         fprintf(stderr, "Rank %d could not allocate the checkpoint\n", rank);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      iteration = solve( &u, &unew, &rho, hsq, &opts, &d, &mg, &cg,
+                         opts.persistent ? &plan : NULL,
+                         halo == HALO_SHARED ? &window : NULL,
+                         halo == HALO_RMA ? &rma : NULL, &check,
+                         checkpoint_every > 0 ? &checkpoint : NULL, checkpoint_every,
+                         first_iteration, max_iter );
+      if( checkpoint_every > 0 ) checkpoint_free( &checkpoint, &d );
+      if( rank == 0 ){
+         printf("Run completed after %d iterations with unorm %.8e\n", iteration, check.unorm);
+         if( check.unorm_iteration >= 0 && check.unorm_iteration != iteration )
+            printf("The change is that of iteration %d, %d iterations before the end\n",
+                   check.unorm_iteration, iteration - check.unorm_iteration);
+      }
+   } else {
+      // Keep the solution in double precision. u and unew hold the
+      // correction, which is zero on the boundary, and res the
+      // residual it solves for.
+      if( refine_init( &refine, &u ) != 0
+       || field_alloc( &res, d.nx, d.ny, opts.layers ) != 0 ){
+         fprintf(stderr, "Rank %d could not allocate the refinement fields\n", rank);
+         MPI_Abort(MPI_COMM_WORLD, 1);
+      }
+      field_fill( &res, 0.0 );
+      rnorm0 = rnorm = refine_residual( &refine, &rho, hsq, &res, &d );
+      iteration = 0;
+      step = 0;
+      while( rnorm > refine_residual_factor*refine_residual_factor*rnorm0 && iteration < max_iter ){
+         double last_rnorm = rnorm;
+         int inner;
+
+         field_fill( &u, 0.0 );
+         field_fill( &unew, 0.0 );
+         if( opts.layers > 1 ) halo_exchange( &res, &d );
+         if( opts.method == METHOD_MG || opts.method == METHOD_FMG ) mg.cycles = 0;
+         if( cg_method ) cg.iterations = 0;
+
+         // The change scales with the square of the residual
+         convergence_init( &check, d.comm, residual*rnorm/rnorm0, cg_method ? 1 : check_every,
+                           check_async && !cg_method );
+         inner = solve( &u, &unew, &res, hsq, &opts, &d, &mg, &cg,
+                        opts.persistent ? &plan : NULL,
+                        halo == HALO_SHARED ? &window : NULL,
+                        halo == HALO_RMA ? &rma : NULL, &check, NULL, 0, 0, max_iter - iteration );
+         iteration += inner;
+         step++;
+
+         refine_correct( &refine, &u );
+         rnorm = refine_residual( &refine, &rho, hsq, &res, &d );
+         if( rank == 0 )
+            printf("Refinement step %d: %d iterations, relative residual %.8e\n",
+                   step, inner, sqrt(rnorm/rnorm0));
+
+         // The correction can no longer improve the solution
+         if( rnorm >= last_rnorm ) break;
+      }
+      if( rank == 0 )
+         printf("Run completed after %d iterations in %d refinement steps with relative residual %.8e\n",
+                iteration, step, sqrt(rnorm/rnorm0));
+      refine_store( &refine, &u );
+      refine_free( &refine );
+      field_free( &res );
+   }
+
+   if( output != NULL && field_write( output, &u, &d, gridsize, gridsize, h, iteration ) != 0 ){
+      if( rank == 0 )
+         fprintf(stderr, "Could not write the field to %s\n", output);
+   }
+
+   // Free memory and finalize
+   if( opts.method == METHOD_MG || opts.method == METHOD_FMG )
+      multigrid_free( &mg );
+   if( opts.method == METHOD_CG || opts.method == METHOD_PIPECG )
+      cg_free( &cg );
+   halo_plan_free( &plan );
+   if( halo == HALO_SHARED ){
+      halo_window_free( &window );
+   } else if( halo == HALO_RMA ){
+      halo_rma_free( &rma );
+   } else {
+      field_free( &u );
+      field_free( &unew );
+   }
+   field_free( &rho );
+   decomp_free( &d );
+
+   // Call finalize at the end
+   return MPI_Finalize();
+}
@@ -0,0 +1,113 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "poisson_field.c"
+#include "poisson_kernels.c"
+#include "poisson_simd.c"
+#include "poisson_decomp.c"
+#include "poisson_halo.c"
+#include "poisson_cg.c"
+
+#define MAX 64
+
+/* Start from u=10 at x=0 and run until the change is below 1e-6.
+   Returns the number of iterations. */
+static int run_cg( const decomp_t *d, field_t *u, int precond, int pipelined ){
+   field_t rho;
+   cg_t cg;
+   double unorm;
+   int iteration;
+
+   assert_int_equal( field_alloc( u, d->nx, d->ny, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, d->nx, d->ny, 1 ), 0 );
+   assert_int_equal( cg_setup( &cg, d, precond, pipelined ), 0 );
+
+   field_fill( u, 0.0 );
+   field_fill( &rho, 0.0 );
+   if( d->left == MPI_PROC_NULL )
+      for( int j=0; j <= d->ny+1; j++ ) FIELD(u, j, 0) = 10;
+
+   iteration = 0;
+   do {
+      unorm = cg_iteration( &cg, u, &rho, 0.01 );
+      iteration++;
+   } while( unorm > 1e-6 && iteration < 10*MAX );
+
+   cg_free( &cg );
+   field_free( &rho );
+   return iteration;
+}
+
+static void test_cg(void **state) {
+   field_t u_sor, rho, u;
+   decomp_t d;
+   int dims[2] = { 0, 0 };
+   double unorm, global_unorm;
+   float diff, max_diff;
+   int iterations, iterations_none;
+
+   assert_int_equal( decomp_create( &d, MAX, MAX, dims, MPI_COMM_WORLD ), 0 );
+
+   // Find the solution with over-relaxation
+   assert_int_equal( field_alloc( &u_sor, d.nx, d.ny, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, d.nx, d.ny, 1 ), 0 );
+   field_fill( &u_sor, 0.0 );
+   field_fill( &rho, 0.0 );
+   if( d.left == MPI_PROC_NULL )
+      for( int j=0; j <= d.ny+1; j++ ) FIELD(&u_sor, j, 0) = 10;
+   do {
+      unorm = 0;
+      for( int parity=0; parity<2; parity++ ){
+         halo_exchange( &u_sor, &d );
+         unorm += relax_colour( &u_sor, &rho, 0.01, sor_optimal_omega(MAX), parity, d.j_offset + d.i_offset );
+      }
+      MPI_Allreduce( &unorm, &global_unorm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+   } while( global_unorm > 1e-7 );
+
+   // Each variant should find the same solution. The preconditioned
+   // ones should need fewer iterations.
+   for( int pipelined=0; pipelined<2; pipelined++ ){
+      for( int precond=PRECOND_NONE; precond<=PRECOND_IC; precond++ ){
+         iterations = run_cg( &d, &u, precond, pipelined );
+         assert_true( iterations < 10*MAX );
+         if( precond == PRECOND_NONE ) iterations_none = iterations;
+         if( precond == PRECOND_IC ) assert_true( iterations < iterations_none );
+
+         max_diff = 0;
+         for( int j=1; j <= d.ny; j++ ){
+            for( int i=1; i <= d.nx; i++ ) {
+               diff = fabs( FIELD(&u, j, i) - FIELD(&u_sor, j, i) );
+               if( diff > max_diff ) max_diff = diff;
+            }
+         }
+         assert_true( max_diff < 5e-3 );
+         field_free( &u );
+      }
+   }
+
+   field_free( &u_sor );
+   field_free( &rho );
+   decomp_free( &d );
+}
+
+/* In the main function create the list of the tests */
+int main(int argc, char** argv) {
+   int cmocka_return_value;
+
+   // First call MPI_Init
+   MPI_Init(&argc, &argv);
+
+   const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_cg),
+   };
+
+   // Call a library function that will run the tests
+   cmocka_return_value = cmocka_run_group_tests(tests, NULL, NULL);
+
+   // Call finalize at the end
+   MPI_Finalize();
+
+   return cmocka_return_value;
+}
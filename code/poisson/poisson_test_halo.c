@@ -0,0 +1,135 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "poisson_field.c"
+#include "poisson_decomp.c"
+#include "poisson_halo.c"
+#include "poisson_window.c"
+#include "poisson_rma.c"
+
+#define MAX 64
+
+/* The grid sizes tested, the second does not divide evenly over
+   any number of ranks */
+#define N_SIZES 2
+static const int sizes[N_SIZES] = { MAX, 37 };
+
+/* Give every point of u, ghost points included, a value set by its
+   global coordinates. The ghost points then only keep their value
+   where there is no neighbour to fill them. */
+static void fill_global( field_t *u, const decomp_t *d ){
+   for( int j=0; j <= u->ny+1; j++ )
+      for( int i=0; i <= u->nx+1; i++ )
+         FIELD(u, j, i) = 1000*(j + d->j_offset) + i + d->i_offset;
+}
+
+/* Scramble the ghost points of u that an exchange has to fill. The
+   corners come with the rows from the neighbours above and below. */
+static void clear_ghosts( field_t *u, const decomp_t *d ){
+   int rank[4];
+
+   decomp_neighbours( d, rank );
+   for( int i=0; i <= u->nx+1; i++ ){
+      if( rank[0] != MPI_PROC_NULL ) FIELD(u, 0, i) = -1;
+      if( rank[1] != MPI_PROC_NULL ) FIELD(u, u->ny+1, i) = -1;
+   }
+   for( int j=1; j <= u->ny; j++ ){
+      if( rank[2] != MPI_PROC_NULL ) FIELD(u, j, 0) = -1;
+      if( rank[3] != MPI_PROC_NULL ) FIELD(u, j, u->nx+1) = -1;
+   }
+}
+
+/* Check that u, filled by another exchange, equals expected, filled
+   by halo_exchange, at every point except the corners if corners is
+   zero. Also check that halo_exchange is complete. */
+static void compare( field_t *u, field_t *expected, const decomp_t *d, int corners ){
+   for( int j=0; j <= d->ny+1; j++ )
+      for( int i=0; i <= d->nx+1; i++ ){
+         int corner = (j == 0 || j == d->ny+1) && (i == 0 || i == d->nx+1);
+         if( corners || !corner ) assert_true( FIELD(u, j, i) == FIELD(expected, j, i) );
+      }
+
+   fill_global( u, d );
+   for( int j=0; j <= d->ny+1; j++ )
+      for( int i=0; i <= d->nx+1; i++ )
+         assert_true( FIELD(u, j, i) == FIELD(expected, j, i) );
+}
+
+/* The shared memory exchange should fill every ghost point,
+   the corners included, like halo_exchange */
+static void test_window(void **state) {
+   field_t u, expected;
+   decomp_t d;
+   halo_window_t window;
+
+   for( int s=0; s < N_SIZES; s++ ){
+      int dims[2] = { 0, 0 };
+
+      assert_int_equal( decomp_create( &d, sizes[s], sizes[s], dims, MPI_COMM_WORLD ), 0 );
+      halo_window_init( &window, &d );
+      assert_int_equal( halo_window_alloc( &window, &u, &d ), 0 );
+      assert_int_equal( field_alloc( &expected, d.nx, d.ny, 1 ), 0 );
+
+      fill_global( &expected, &d );
+      clear_ghosts( &expected, &d );
+      field_copy( &u, &expected );
+      halo_exchange( &expected, &d );
+      halo_window_exchange( &window, &u, &d );
+      compare( &u, &expected, &d, 1 );
+
+      field_free( &expected );
+      halo_window_free( &window );
+      decomp_free( &d );
+   }
+}
+
+/* The one-sided exchange should fill the ghost points like
+   halo_exchange, except for the corners */
+static void test_rma(void **state) {
+   field_t u, expected;
+   decomp_t d;
+   halo_rma_t rma;
+
+   for( int s=0; s < N_SIZES; s++ ){
+      int dims[2] = { 0, 0 };
+
+      assert_int_equal( decomp_create( &d, sizes[s], sizes[s], dims, MPI_COMM_WORLD ), 0 );
+      halo_rma_init( &rma, &d );
+      assert_int_equal( halo_rma_alloc( &rma, &u, &d ), 0 );
+      assert_int_equal( field_alloc( &expected, d.nx, d.ny, 1 ), 0 );
+
+      fill_global( &expected, &d );
+      clear_ghosts( &expected, &d );
+      field_copy( &u, &expected );
+      halo_exchange( &expected, &d );
+      halo_rma_exchange( &rma, &u, &d );
+      compare( &u, &expected, &d, 0 );
+
+      field_free( &expected );
+      halo_rma_free( &rma );
+      decomp_free( &d );
+   }
+}
+
+/* In the main function create the list of the tests */
+int main(int argc, char** argv) {
+   int cmocka_return_value;
+
+   // First call MPI_Init
+   MPI_Init(&argc, &argv);
+
+   const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_window),
+      cmocka_unit_test(test_rma),
+   };
+
+   // Call a library function that will run the tests
+   cmocka_return_value = cmocka_run_group_tests(tests, NULL, NULL);
+
+   // Call finalize at the end
+   MPI_Finalize();
+
+   return cmocka_return_value;
+}
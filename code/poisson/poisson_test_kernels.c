@@ -0,0 +1,247 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "poisson_field.c"
+#include "poisson_kernels.c"
+#include "poisson_simd.c"
+
+#define MAX 20
+
+/* Run the test of poisson_test.c with a given kernel. The tiled
+   kernel runs tiles of 6 columns and 3 sweeps per call. */
+static double run_kernel( int kernel, field_t *u, int steps ){
+   field_t unew, rho;
+   float h, hsq;
+   double unorm;
+
+   /* Set variables */
+   h = 0.1;
+   hsq = h*h;
+
+   assert_int_equal( field_alloc( u, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &unew, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, MAX, MAX, 1 ), 0 );
+
+   // Initialise the u and rho field to 0
+   field_fill( u, 0.0 );
+   field_fill( &rho, 0.0 );
+
+   // Test a configuration with u=10 at x=1 and y=1
+   FIELD(u, 1, 1) = 10;
+   field_copy( &unew, u );
+
+   if( kernel == KERNEL_TILED ){
+      for( int iteration=0; iteration<steps; iteration+=3 ){
+         unorm = jacobi_sweep_tiled( u, &unew, &rho, hsq, 6, 3, NULL );
+      }
+   } else {
+      for( int iteration=0; iteration<steps; iteration++ ){
+         unorm = jacobi_sweep( u, &unew, &rho, hsq, kernel );
+      }
+   }
+
+   field_free( &unew );
+   field_free( &rho );
+   return unorm;
+}
+
+static void test_reference_kernel(void **state) {
+   field_t u;
+   double unorm, diff;
+
+   // Test one step
+   unorm = run_kernel( KERNEL_REFERENCE, &u, 1 );
+   assert_true( unorm == 112.5 );
+   field_free( &u );
+
+   // Test 51 steps
+   unorm = run_kernel( KERNEL_REFERENCE, &u, 51 );
+   diff = unorm - 0.001838809444;
+   assert_true( diff*diff < 1e-16 );
+   field_free( &u );
+}
+
+static void test_fused_kernel(void **state) {
+   field_t u, u_reference;
+   double unorm, unorm_reference;
+
+   // Test one step
+   unorm = run_kernel( KERNEL_FUSED, &u, 1 );
+   assert_true( unorm == 112.5 );
+   field_free( &u );
+
+   // The fused kernel should give exactly the same result
+   // as the reference kernel
+   unorm = run_kernel( KERNEL_FUSED, &u, 51 );
+   unorm_reference = run_kernel( KERNEL_REFERENCE, &u_reference, 51 );
+   assert_true( unorm == unorm_reference );
+   for( int j=0; j <= MAX+1; j++ ){
+      for( int i=0; i <= MAX+1; i++ ) {
+         assert_true( FIELD(&u, j, i) == FIELD(&u_reference, j, i) );
+      }
+   }
+   field_free( &u );
+   field_free( &u_reference );
+}
+
+static void test_simd_kernels(void **state) {
+   field_t u, u_scalar;
+   double unorm, unorm_scalar, diff;
+
+   unorm_scalar = run_kernel( KERNEL_FUSED, &u_scalar, 51 );
+
+   // The vectorised kernels compute the same points, but sum the
+   // norm in a different order
+   for( int isa=ISA_SSE2; isa<=ISA_AVX512; isa++ ){
+      if( !isa_supported(isa) ) continue;
+      assert_int_equal( kernel_select_isa(isa), isa );
+
+      // Test one step
+      unorm = run_kernel( KERNEL_FUSED, &u, 1 );
+      assert_true( unorm == 112.5 );
+      field_free( &u );
+
+      // Test 51 steps
+      unorm = run_kernel( KERNEL_FUSED, &u, 51 );
+      diff = unorm - unorm_scalar;
+      assert_true( diff*diff < 1e-24 );
+      for( int j=0; j <= MAX+1; j++ ){
+         for( int i=0; i <= MAX+1; i++ ) {
+            float fdiff = FIELD(&u, j, i) - FIELD(&u_scalar, j, i);
+            assert_true( fdiff*fdiff < 1e-12 );
+         }
+      }
+      field_free( &u );
+   }
+   kernel_select_isa( ISA_SCALAR );
+   field_free( &u_scalar );
+}
+
+static void test_tiled_kernel(void **state) {
+   field_t u, u_fused;
+   double unorm, unorm_fused, diff;
+
+   // After 51 sweeps the field should be the same as with the fused
+   // kernel. The norm is only summed in a different order.
+   unorm = run_kernel( KERNEL_TILED, &u, 51 );
+   unorm_fused = run_kernel( KERNEL_FUSED, &u_fused, 51 );
+   diff = unorm - unorm_fused;
+   assert_true( diff*diff < 1e-24 );
+   for( int j=0; j <= MAX+1; j++ ){
+      for( int i=0; i <= MAX+1; i++ ) {
+         assert_true( FIELD(&u, j, i) == FIELD(&u_fused, j, i) );
+      }
+   }
+   field_free( &u );
+   field_free( &u_fused );
+}
+
+static void test_blocks(void **state) {
+   field_t u, u_fused, unew, rho;
+   double unorm, unorm_fused, diff;
+
+   assert_int_equal( field_alloc( &unew, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, MAX, MAX, 1 ), 0 );
+   field_fill( &rho, 0.0 );
+
+   // Update the interior first and the boundary rows and columns
+   // after it, as when overlapping the halo exchange
+   unorm_fused = run_kernel( KERNEL_FUSED, &u_fused, 1 );
+   assert_int_equal( field_alloc( &u, MAX, MAX, 1 ), 0 );
+   field_fill( &u, 0.0 );
+   FIELD(&u, 1, 1) = 10;
+   field_copy( &unew, &u );
+   unorm = jacobi_block( &u, &unew, &rho, 0.01, 2, MAX-1, 2, MAX-1, 0.0 );
+   unorm = jacobi_block( &u, &unew, &rho, 0.01, 1, 1, 1, MAX, unorm );
+   unorm = jacobi_block( &u, &unew, &rho, 0.01, MAX, MAX, 1, MAX, unorm );
+   unorm = jacobi_block( &u, &unew, &rho, 0.01, 2, MAX-1, 1, 1, unorm );
+   unorm = jacobi_block( &u, &unew, &rho, 0.01, 2, MAX-1, MAX, MAX, unorm );
+   diff = unorm - unorm_fused;
+   assert_true( diff*diff < 1e-24 );
+   for( int j=0; j <= MAX+1; j++ ){
+      for( int i=0; i <= MAX+1; i++ ) {
+         assert_true( FIELD(&unew, j, i) == FIELD(&u_fused, j, i) );
+      }
+   }
+
+   field_free( &u );
+   field_free( &u_fused );
+   field_free( &unew );
+   field_free( &rho );
+}
+
+static void test_red_black(void **state) {
+   field_t u, u_jacobi, unew, rho;
+   double unorm;
+   float diff, max_diff;
+   int iteration, iteration_jacobi;
+
+   assert_int_equal( field_alloc( &u, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &u_jacobi, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &unew, MAX, MAX, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, MAX, MAX, 1 ), 0 );
+   field_fill( &u, 0.0 );
+   field_fill( &rho, 0.0 );
+   FIELD(&u, 1, 1) = 10;
+
+   // The point x=1, y=1 is even and is set to 0 by the first
+   // colour. Its odd neighbours then see only zeros.
+   unorm = relax_colour( &u, &rho, 0.01, 1.0, 0, 0 );
+   unorm += relax_colour( &u, &rho, 0.01, 1.0, 1, 0 );
+   assert_true( unorm == 100 );
+
+   // Start from u=10 at x=0 and converge with over-relaxation
+   field_fill( &u, 0.0 );
+   for( int j=0; j <= MAX+1; j++ ) FIELD(&u, j, 0) = 10;
+   field_copy( &u_jacobi, &u );
+   field_copy( &unew, &u );
+   iteration = 0;
+   do {
+      unorm = relax_colour( &u, &rho, 0.01, sor_optimal_omega(MAX), 0, 0 );
+      unorm += relax_colour( &u, &rho, 0.01, sor_optimal_omega(MAX), 1, 0 );
+      iteration++;
+   } while( unorm > 1e-6 );
+
+   // The Jacobi iteration needs many more steps for the same change
+   iteration_jacobi = 0;
+   do {
+      unorm = jacobi_sweep( &u_jacobi, &unew, &rho, 0.01, KERNEL_FUSED );
+      iteration_jacobi++;
+   } while( unorm > 1e-6 );
+   assert_true( 5*iteration < iteration_jacobi );
+
+   // Both should approach the same solution
+   do {
+      unorm = jacobi_sweep( &u_jacobi, &unew, &rho, 0.01, KERNEL_FUSED );
+   } while( unorm > 1e-12 );
+   max_diff = 0;
+   for( int j=0; j <= MAX+1; j++ ){
+      for( int i=0; i <= MAX+1; i++ ) {
+         diff = fabs( FIELD(&u, j, i) - FIELD(&u_jacobi, j, i) );
+         if( diff > max_diff ) max_diff = diff;
+      }
+   }
+   assert_true( max_diff < 1e-3 );
+
+   field_free( &u );
+   field_free( &u_jacobi );
+   field_free( &unew );
+   field_free( &rho );
+}
+
+/* In the main function create the list of the tests */
+int main(void) {
+   const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_reference_kernel),
+      cmocka_unit_test(test_fused_kernel),
+      cmocka_unit_test(test_simd_kernels),
+      cmocka_unit_test(test_tiled_kernel),
+      cmocka_unit_test(test_blocks),
+      cmocka_unit_test(test_red_black),
+   };
+
+   // Call a library function that will run the tests
+   return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,91 @@
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "poisson_field.c"
+#include "poisson_kernels.c"
+#include "poisson_simd.c"
+#include "poisson_decomp.c"
+#include "poisson_halo.c"
+#include "poisson_multigrid.c"
+
+#define MAX 64
+
+static void test_multigrid(void **state) {
+   field_t u, unew, u_sor, rho;
+   decomp_t d;
+   int dims[2] = { 0, 0 };
+   multigrid_t mg;
+   float hsq = 0.01;
+   double unorm, global_unorm;
+   float diff, max_diff;
+
+   assert_int_equal( decomp_create( &d, MAX, MAX, dims, MPI_COMM_WORLD ), 0 );
+
+   assert_int_equal( field_alloc( &u, d.nx, d.ny, 1 ), 0 );
+   assert_int_equal( field_alloc( &unew, d.nx, d.ny, 1 ), 0 );
+   assert_int_equal( field_alloc( &u_sor, d.nx, d.ny, 1 ), 0 );
+   assert_int_equal( field_alloc( &rho, d.nx, d.ny, 1 ), 0 );
+   assert_int_equal( multigrid_setup( &mg, &d, hsq ), 0 );
+
+   // Start from u=10 at x=0
+   field_fill( &u, 0.0 );
+   field_fill( &rho, 0.0 );
+   if( d.left == MPI_PROC_NULL )
+      for( int j=0; j <= d.ny+1; j++ ) FIELD(&u, j, 0) = 10;
+   field_copy( &u_sor, &u );
+
+   // Each V-cycle should reduce the change by a large factor
+   for( int cycle=0; cycle<6; cycle++ ){
+      unorm = multigrid_cycle( &mg, &u, &unew, &rho, 0 );
+   }
+   MPI_Allreduce( &unorm, &global_unorm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+   assert_true( global_unorm < 1e-6 );
+
+   // Compare to the solution found with over-relaxation
+   do {
+      unorm = 0;
+      for( int parity=0; parity<2; parity++ ){
+         halo_exchange( &u_sor, &d );
+         unorm += relax_colour( &u_sor, &rho, hsq, sor_optimal_omega(MAX), parity, d.j_offset + d.i_offset );
+      }
+      MPI_Allreduce( &unorm, &global_unorm, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD );
+   } while( global_unorm > 1e-7 );
+
+   max_diff = 0;
+   for( int j=1; j <= d.ny; j++ ){
+      for( int i=1; i <= d.nx; i++ ) {
+         diff = fabs( FIELD(&u, j, i) - FIELD(&u_sor, j, i) );
+         if( diff > max_diff ) max_diff = diff;
+      }
+   }
+   assert_true( max_diff < 1e-3 );
+
+   multigrid_free( &mg );
+   field_free( &u );
+   field_free( &unew );
+   field_free( &u_sor );
+   field_free( &rho );
+   decomp_free( &d );
+}
+
+/* In the main function create the list of the tests */
+int main(int argc, char** argv) {
+   int cmocka_return_value;
+
+   // First call MPI_Init
+   MPI_Init(&argc, &argv);
+
+   const struct CMUnitTest tests[] = {
+      cmocka_unit_test(test_multigrid),
+   };
+
+   // Call a library function that will run the tests
+   cmocka_return_value = cmocka_run_group_tests(tests, NULL, NULL);
+
+   // Call finalize at the end
+   MPI_Finalize();
+
+   return cmocka_return_value;
+}
@@ -0,0 +1,165 @@
+/* Halo exchange through shared memory windows */
+
+/* A message between two ranks on the same node is copied into the
+   memory of the MPI library and out again. With the fields in
+   shared memory the ghost points are copied directly from the field
+   of the neighbour. The ranks only need to agree on when the
+   boundary is ready to be read and when it may be written again,
+   which takes zero byte messages between the neighbours and
+   MPI_Win_sync to order the memory accesses. */
+
+#include "poisson_window.h"
+
+
+/* Tags of the messages, after those of poisson_halo.c */
+enum {
+  TAG_SHAPE = 5,
+  TAG_READY,
+  TAG_DONE
+};
+
+
+/* Find the ranks of the node and which of the neighbours are on it */
+void halo_window_init( halo_window_t *w, const decomp_t *d ){
+  MPI_Group group, node_group;
+  int rank[4];
+
+  MPI_Comm_split_type( d->comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &w->node );
+  MPI_Comm_group( d->comm, &group );
+  MPI_Comm_group( w->node, &node_group );
+  decomp_neighbours( d, rank );
+  MPI_Group_translate_ranks( group, 4, rank, node_group, w->node_rank );
+  for( int k=0; k<4; k++ )
+    w->on_node[k] = w->node_rank[k] != MPI_UNDEFINED && w->node_rank[k] != MPI_PROC_NULL;
+  MPI_Group_free( &group );
+  MPI_Group_free( &node_group );
+
+  w->n_fields = 0;
+}
+
+
+/* Allocate f for the block of d in a shared window, with a single
+   ghost layer. All ranks of the decomposition must call this
+   together. Returns 0 on success and -1 if there is no room for
+   another field. */
+int halo_window_alloc( halo_window_t *w, field_t *f, const decomp_t *d ){
+  int n = w->n_fields, rank[4];
+  int shape[2] = { d->nx, d->ny }, shapes[4][2];
+  MPI_Request requests[8];
+  MPI_Info info;
+  void *base;
+
+  if( n == HALO_WINDOW_FIELDS ) return -1;
+
+  // Let each rank have memory on its own pages, with a cache line
+  // to spare for the alignment
+  MPI_Info_create( &info );
+  MPI_Info_set( info, "alloc_shared_noncontig", "true" );
+  MPI_Win_allocate_shared( field_size(d->nx, d->ny, 1) + FIELD_ALIGNMENT, sizeof(float),
+                           info, w->node, &base, &w->win[n] );
+  MPI_Info_free( &info );
+  field_wrap( f, decomp_align_window(base), d->nx, d->ny, 1 );
+  w->data[n] = f->data;
+
+  // The blocks of the neighbours may differ in size by one point
+  decomp_neighbours( d, rank );
+  for( int k=0; k<4; k++ ){
+    MPI_Irecv( shapes[k], 2, MPI_INT, rank[k], TAG_SHAPE, d->comm, &requests[k] );
+    MPI_Isend( shape, 2, MPI_INT, rank[k], TAG_SHAPE, d->comm, &requests[4+k] );
+  }
+  MPI_Waitall( 8, requests, MPI_STATUSES_IGNORE );
+
+  for( int k=0; k<4; k++ ){
+    field_t *neighbour = &w->neighbour[n][k];
+    MPI_Aint size;
+    int unit;
+
+    neighbour->data = NULL;
+    if( !w->on_node[k] ) continue;
+    MPI_Win_shared_query( w->win[n], w->node_rank[k], &size, &unit, &base );
+    field_wrap( neighbour, decomp_align_window(base), shapes[k][0], shapes[k][1], 1 );
+  }
+
+  // A single passive epoch for the life of the window, the
+  // accesses are ordered by MPI_Win_sync and the messages
+  MPI_Win_lock_all( MPI_MODE_NOCHECK, w->win[n] );
+  w->n_fields++;
+  return 0;
+}
+
+
+/* Wait for the neighbours first..last on the node to reach the
+   same point. Memory written before is visible to them afterwards
+   and the other way round. */
+static void meet( const halo_window_t *w, MPI_Win win, const decomp_t *d,
+                  int first, int last, int tag ){
+  MPI_Request requests[8];
+  int rank[4], n_requests = 0;
+
+  decomp_neighbours( d, rank );
+  MPI_Win_sync( win );
+  for( int k=first; k<=last; k++ ){
+    if( !w->on_node[k] ) continue;
+    MPI_Irecv( NULL, 0, MPI_BYTE, rank[k], tag, d->comm, &requests[n_requests++] );
+    MPI_Isend( NULL, 0, MPI_BYTE, rank[k], tag, d->comm, &requests[n_requests++] );
+  }
+  MPI_Waitall( n_requests, requests, MPI_STATUSES_IGNORE );
+  MPI_Win_sync( win );
+}
+
+
+/* Fill the ghost layer of u like halo_exchange, including the
+   corners. u must have been allocated with halo_window_alloc. */
+void halo_window_exchange( halo_window_t *w, field_t *u, const decomp_t *d ){
+  int nx = u->nx, ny = u->ny, f = 0;
+  int down, up, left, right;
+  const field_t *neighbour;
+  MPI_Win win;
+
+  while( w->data[f] != u->data ) f++;
+  win = w->win[f];
+  neighbour = w->neighbour[f];
+
+  // Messages only go to the neighbours on other nodes
+  down = w->on_node[0] ? MPI_PROC_NULL : d->down;
+  up = w->on_node[1] ? MPI_PROC_NULL : d->up;
+  left = w->on_node[2] ? MPI_PROC_NULL : d->left;
+  right = w->on_node[3] ? MPI_PROC_NULL : d->right;
+
+  // The columns, once the neighbours have finished their update
+  meet( w, win, d, 2, 3, TAG_READY );
+  MPI_Sendrecv( &FIELD(u,1,1), 1, d->column, left, 1,
+                &FIELD(u,1,nx+1), 1, d->column, right, 1, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &FIELD(u,1,nx), 1, d->column, right, 2,
+                &FIELD(u,1,0), 1, d->column, left, 2, d->comm, MPI_STATUS_IGNORE );
+  if( w->on_node[2] )
+    for( int j=1; j <= ny; j++ ) FIELD(u, j, 0) = FIELD(&neighbour[2], j, neighbour[2].nx);
+  if( w->on_node[3] )
+    for( int j=1; j <= ny; j++ ) FIELD(u, j, nx+1) = FIELD(&neighbour[3], j, 1);
+
+  // The rows with the ghost columns, once the neighbours have
+  // received their columns
+  meet( w, win, d, 0, 1, TAG_READY );
+  MPI_Sendrecv( &FIELD(u,1,0), nx+2, MPI_FLOAT, down, 3,
+                &FIELD(u,ny+1,0), nx+2, MPI_FLOAT, up, 3, d->comm, MPI_STATUS_IGNORE );
+  MPI_Sendrecv( &FIELD(u,ny,0), nx+2, MPI_FLOAT, up, 4,
+                &FIELD(u,0,0), nx+2, MPI_FLOAT, down, 4, d->comm, MPI_STATUS_IGNORE );
+  if( w->on_node[0] )
+    for( int i=0; i <= nx+1; i++ ) FIELD(u, 0, i) = FIELD(&neighbour[0], neighbour[0].ny, i);
+  if( w->on_node[1] )
+    for( int i=0; i <= nx+1; i++ ) FIELD(u, ny+1, i) = FIELD(&neighbour[1], 1, i);
+
+  // The neighbours must not change the field until all have read it
+  meet( w, win, d, 0, 3, TAG_DONE );
+}
+
+
+/* Free the windows and with them the memory of the fields */
+void halo_window_free( halo_window_t *w ){
+  for( int f=0; f < w->n_fields; f++ ){
+    MPI_Win_unlock_all( w->win[f] );
+    MPI_Win_free( &w->win[f] );
+  }
+  w->n_fields = 0;
+  MPI_Comm_free( &w->node );
+}
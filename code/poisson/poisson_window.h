@@ -0,0 +1,32 @@
+/* Halo exchange through shared memory windows */
+
+#ifndef POISSON_WINDOW_H
+#define POISSON_WINDOW_H
+
+#include <mpi.h>
+
+#include "poisson_field.h"
+#include "poisson_decomp.h"
+
+/* Fields allocated in MPI shared memory windows. The ranks on the
+   same node copy the halo straight out of each other's fields, only
+   the neighbours on other nodes exchange messages. The fields are
+   found by their memory, so they may be swapped with field_swap.
+   The directions are ordered down, up, left and right. */
+#define HALO_WINDOW_FIELDS 2
+typedef struct {
+  MPI_Comm node;       // The ranks sharing memory with this one
+  int on_node[4];      // The neighbour is on this node
+  int node_rank[4];    // Its rank in node
+  int n_fields;
+  MPI_Win win[HALO_WINDOW_FIELDS];
+  const float *data[HALO_WINDOW_FIELDS];
+  field_t neighbour[HALO_WINDOW_FIELDS][4]; // The fields of the neighbours on the node
+} halo_window_t;
+
+void halo_window_init( halo_window_t *w, const decomp_t *d );
+int halo_window_alloc( halo_window_t *w, field_t *f, const decomp_t *d );
+void halo_window_exchange( halo_window_t *w, field_t *u, const decomp_t *d );
+void halo_window_free( halo_window_t *w );
+
+#endif